@@ -20,10 +20,13 @@
 // ------------------------------------------------------------------------------
 
 static const char osgOcean_ocean_surface_frag[] =
+	"#extension GL_EXT_texture_array : enable\n"
+	"\n"
 	"uniform bool osgOcean_EnableReflections;\n"
 	"uniform bool osgOcean_EnableRefractions;\n"
 	"uniform bool osgOcean_EnableHeightmap;\n"
 	"uniform bool osgOcean_EnableCrestFoam;\n"
+	"uniform bool osgOcean_EnableJacobianFoam;\n"
 	"uniform bool osgOcean_EnableUnderwaterScattering;\n"
 	"\n"
 	"uniform bool osgOcean_EnableDOF;\n"
@@ -40,7 +43,9 @@ static const char osgOcean_ocean_surface_frag[] =
 	"uniform sampler2D   osgOcean_RefractionMap;\n"
 	"uniform sampler2D   osgOcean_RefractionDepthMap;\n"
 	"uniform sampler2D   osgOcean_FoamMap;\n"
+	"uniform sampler2DArray osgOcean_JacobianMap;\n"
 	"uniform sampler2D   osgOcean_NoiseMap;\n"
+	"uniform sampler2DArray osgOcean_CascadeMap;\n"
 	"uniform sampler2D   osgOcean_Heightmap;\n"
 	"\n"
 	"uniform float osgOcean_UnderwaterFogDensity;\n"
@@ -59,6 +64,13 @@ static const char osgOcean_ocean_surface_frag[] =
 	"uniform float osgOcean_WaterHeight;\n"
 	"uniform float osgOcean_FoamCapBottom;\n"
 	"uniform float osgOcean_FoamCapTop;\n"
+	"uniform float osgOcean_FoamJacobianBottom;\n"
+	"uniform float osgOcean_FoamJacobianTop;\n"
+	"uniform float osgOcean_JacobianFrame;\n"
+	"\n"
+	"uniform int   osgOcean_NumCascades;\n"
+	"uniform float osgOcean_CascadeScales[4];\n"
+	"uniform float osgOcean_CascadeLayer;\n"
 	"\n"
 	"varying vec3 vNormal;\n"
 	"varying vec3 vViewerDir;\n"
@@ -177,6 +189,12 @@ static const char osgOcean_ocean_surface_frag[] =
 	"    return exp2(density * fogCoord * fogCoord );\n"
 	"}\n"
 	"\n"
+	"// Normal maps only store x and y (signed RGTC2), z is rebuilt from them\n"
+	"vec3 decodeNormal( vec4 texel )\n"
+	"{\n"
+	"    return vec3( texel.xy, sqrt( max( 1.0 - dot( texel.xy, texel.xy ), 0.0 ) ) );\n"
+	"}\n"
+	"\n"
 	"// -------------------------------\n"
 	"//          Main Program\n"
 	"// -------------------------------\n"
@@ -185,8 +203,20 @@ static const char osgOcean_ocean_surface_frag[] =
 	"{\n"
 	"    vec4 final_color;\n"
 	"\n"
-	"    vec3 noiseNormal = vec3( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].xy ) * 2.0 - 1.0 );\n"
-	"    noiseNormal += vec3( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].zw ) * 2.0 - 1.0 );\n"
+	"    vec3 noiseNormal = decodeNormal( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].xy ) );\n"
+	"    noiseNormal += decodeNormal( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].zw ) );\n"
+	"\n"
+	"    // Detail cascades hold the waves too short for the geometry, sum their slopes\n"
+	"    for(int i = 0; i < 4; ++i)\n"
+	"    {\n"
+	"        if( i >= osgOcean_NumCascades )\n"
+	"            break;\n"
+	"\n"
+	"        vec3 coords = vec3( gl_TexCoord[2].st * osgOcean_CascadeScales[i], osgOcean_CascadeLayer + float(i) );\n"
+	"        vec3 n = decodeNormal( texture2DArray( osgOcean_CascadeMap, coords ) );\n"
+	"\n"
+	"        noiseNormal.xy += n.xy / max( n.z, 0.05 );\n"
+	"    }\n"
 	"\n"
 	"    worldObjectMatrix = osg_ViewMatrixInverse * gl_ModelViewMatrix;\n"
 	"\n"
@@ -276,7 +306,20 @@ static const char osgOcean_ocean_surface_frag[] =
 	"\n"
 	"        if(osgOcean_EnableCrestFoam)\n"
 	"        {\n"
-	"            if( vVertex.z > osgOcean_FoamCapBottom || \n"
+	"            float crest = 0.0;\n"
+	"\n"
+	"            if (osgOcean_EnableJacobianFoam)\n"
+	"            {\n"
+	"                // Foam where the choppy surface is compressed or folds over\n"
+	"                float jacobian = texture2DArray( osgOcean_JacobianMap, vec3(gl_TexCoord[2].st, osgOcean_JacobianFrame) ).r * 2.0;\n"
+	"                crest = clamp( alphaHeight( osgOcean_FoamJacobianBottom, osgOcean_FoamJacobianTop, jacobian ), 0.0, 1.0 );\n"
+	"            }\n"
+	"            else if( vVertex.z > osgOcean_FoamCapBottom )\n"
+	"            {\n"
+	"                crest = alphaHeight( osgOcean_FoamCapBottom, osgOcean_FoamCapTop, vVertex.z );\n"
+	"            }\n"
+	"\n"
+	"            if( crest > 0.0 || \n"
 	"                (osgOcean_EnableHeightmap && waterHeight < 10.0))\n"
 	"            {\n"
 	"                vec4 foam_color = texture2D( osgOcean_FoamMap, gl_TexCoord[1].st / 10.0);\n"
@@ -284,12 +327,12 @@ static const char osgOcean_ocean_surface_frag[] =
 	"                float alpha;\n"
 	"                if (osgOcean_EnableHeightmap)\n"
 	"                {\n"
-	"                    alpha = max(alphaHeight( osgOcean_FoamCapBottom, osgOcean_FoamCapTop, vVertex.z ) * (fresnel*2.0),\n"
+	"                    alpha = max(crest * (fresnel*2.0),\n"
 	"                                  0.8 - clamp(waterHeight / 10.0, 0.0, 0.8));\n"
 	"                }\n"
 	"                else\n"
 	"                {\n"
-	"                    alpha = alphaHeight( osgOcean_FoamCapBottom, osgOcean_FoamCapTop, vVertex.z ) * (fresnel*2.0);\n"
+	"                    alpha = crest * (fresnel*2.0);\n"
 	"                }\n"
 	"                final_color = final_color + (foam_color * alpha);\n"
 	"            }\n"
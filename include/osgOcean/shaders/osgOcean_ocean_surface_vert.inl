@@ -31,6 +31,7 @@ static const char osgOcean_ocean_surface_vert[] =
 	"uniform vec4 osgOcean_WaveBot;\n"
 	"\n"
 	"uniform float osgOcean_FoamScale;\n"
+	"uniform vec3 osgOcean_JacobianCoords;\n"
 	"\n"
 	"uniform float osgOcean_FrameTime;\n"
 	"\n"
@@ -150,6 +151,10 @@ static const char osgOcean_ocean_surface_vert[] =
 	"    // Foam coords\n"
 	"    gl_TexCoord[1].st = gl_Vertex.xy * osgOcean_FoamScale;\n"
 	"\n"
+	"    // Jacobian map coords, tile rows run down the y axis\n"
+	"    gl_TexCoord[2].s =  ( gl_Vertex.x - osgOcean_JacobianCoords.x ) * osgOcean_JacobianCoords.z;\n"
+	"    gl_TexCoord[2].t = -( gl_Vertex.y - osgOcean_JacobianCoords.y ) * osgOcean_JacobianCoords.z;\n"
+	"\n"
 	"    // Fog coords\n"
 	"    gl_FogFragCoord = gl_Position.z;\n"
 	"    \n"
@@ -1,7 +1,10 @@
+#extension GL_EXT_texture_array : enable
+
 uniform bool osgOcean_EnableReflections;
 uniform bool osgOcean_EnableRefractions;
 uniform bool osgOcean_EnableHeightmap;
 uniform bool osgOcean_EnableCrestFoam;
+uniform bool osgOcean_EnableJacobianFoam;
 uniform bool osgOcean_EnableUnderwaterScattering;
 
 uniform bool osgOcean_EnableDOF;
@@ -18,7 +21,9 @@ uniform sampler2D   osgOcean_ReflectionMap;
 uniform sampler2D   osgOcean_RefractionMap;
 uniform sampler2D   osgOcean_RefractionDepthMap;
 uniform sampler2D   osgOcean_FoamMap;
+uniform sampler2DArray osgOcean_JacobianMap;
 uniform sampler2D   osgOcean_NoiseMap;
+uniform sampler2DArray osgOcean_CascadeMap;
 uniform sampler2D   osgOcean_Heightmap;
 
 uniform float osgOcean_UnderwaterFogDensity;
@@ -37,6 +42,13 @@ uniform vec2 osgOcean_ViewportDimensions;
 uniform float osgOcean_WaterHeight;
 uniform float osgOcean_FoamCapBottom;
 uniform float osgOcean_FoamCapTop;
+uniform float osgOcean_FoamJacobianBottom;
+uniform float osgOcean_FoamJacobianTop;
+uniform float osgOcean_JacobianFrame;
+
+uniform int   osgOcean_NumCascades;
+uniform float osgOcean_CascadeScales[4];
+uniform float osgOcean_CascadeLayer;
 
 varying vec3 vNormal;
 varying vec3 vViewerDir;
@@ -155,6 +167,12 @@ float computeFogFactor( float density, float fogCoord )
     return exp2(density * fogCoord * fogCoord );
 }
 
+// Normal maps only store x and y (signed RGTC2), z is rebuilt from them
+vec3 decodeNormal( vec4 texel )
+{
+    return vec3( texel.xy, sqrt( max( 1.0 - dot( texel.xy, texel.xy ), 0.0 ) ) );
+}
+
 // -------------------------------
 //          Main Program
 // -------------------------------
@@ -163,8 +181,20 @@ void main( void )
 {
     vec4 final_color;
 
-    vec3 noiseNormal = vec3( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].xy ) * 2.0 - 1.0 );
-    noiseNormal += vec3( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].zw ) * 2.0 - 1.0 );
+    vec3 noiseNormal = decodeNormal( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].xy ) );
+    noiseNormal += decodeNormal( texture2D( osgOcean_NoiseMap, gl_TexCoord[0].zw ) );
+
+    // Detail cascades hold the waves too short for the geometry, sum their slopes
+    for(int i = 0; i < 4; ++i)
+    {
+        if( i >= osgOcean_NumCascades )
+            break;
+
+        vec3 coords = vec3( gl_TexCoord[2].st * osgOcean_CascadeScales[i], osgOcean_CascadeLayer + float(i) );
+        vec3 n = decodeNormal( texture2DArray( osgOcean_CascadeMap, coords ) );
+
+        noiseNormal.xy += n.xy / max( n.z, 0.05 );
+    }
 
     worldObjectMatrix = osg_ViewMatrixInverse * gl_ModelViewMatrix;
 
@@ -254,7 +284,20 @@ void main( void )
 
         if(osgOcean_EnableCrestFoam)
         {
-            if( vVertex.z > osgOcean_FoamCapBottom || 
+            float crest = 0.0;
+
+            if (osgOcean_EnableJacobianFoam)
+            {
+                // Foam where the choppy surface is compressed or folds over
+                float jacobian = texture2DArray( osgOcean_JacobianMap, vec3(gl_TexCoord[2].st, osgOcean_JacobianFrame) ).r * 2.0;
+                crest = clamp( alphaHeight( osgOcean_FoamJacobianBottom, osgOcean_FoamJacobianTop, jacobian ), 0.0, 1.0 );
+            }
+            else if( vVertex.z > osgOcean_FoamCapBottom )
+            {
+                crest = alphaHeight( osgOcean_FoamCapBottom, osgOcean_FoamCapTop, vVertex.z );
+            }
+
+            if( crest > 0.0 || 
                 (osgOcean_EnableHeightmap && waterHeight < 10.0))
             {
                 vec4 foam_color = texture2D( osgOcean_FoamMap, gl_TexCoord[1].st / 10.0);
@@ -262,12 +305,12 @@ void main( void )
                 float alpha;
                 if (osgOcean_EnableHeightmap)
                 {
-                    alpha = max(alphaHeight( osgOcean_FoamCapBottom, osgOcean_FoamCapTop, vVertex.z ) * (fresnel*2.0),
+                    alpha = max(crest * (fresnel*2.0),
                                   0.8 - clamp(waterHeight / 10.0, 0.0, 0.8));
                 }
                 else
                 {
-                    alpha = alphaHeight( osgOcean_FoamCapBottom, osgOcean_FoamCapTop, vVertex.z ) * (fresnel*2.0);
+                    alpha = crest * (fresnel*2.0);
                 }
                 final_color = final_color + (foam_color * alpha);
             }
@@ -9,6 +9,7 @@ uniform vec4 osgOcean_WaveTop;
 uniform vec4 osgOcean_WaveBot;
 
 uniform float osgOcean_FoamScale;
+uniform vec3 osgOcean_JacobianCoords;
 
 uniform float osgOcean_FrameTime;
 
@@ -128,6 +129,10 @@ void main( void )
     // Foam coords
     gl_TexCoord[1].st = gl_Vertex.xy * osgOcean_FoamScale;
 
+    // Jacobian map coords, tile rows run down the y axis
+    gl_TexCoord[2].s =  ( gl_Vertex.x - osgOcean_JacobianCoords.x ) * osgOcean_JacobianCoords.z;
+    gl_TexCoord[2].t = -( gl_Vertex.y - osgOcean_JacobianCoords.y ) * osgOcean_JacobianCoords.z;
+
     // Fog coords
     gl_FogFragCoord = gl_Position.z;
     
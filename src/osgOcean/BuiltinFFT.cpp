@@ -0,0 +1,318 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+#include <osgOcean/FFTBackend>
+#include "BuiltinFFTKernels.h"
+#include "SIMD.h"
+
+#include <osg/Notify>
+#include <osg/Math>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace osgOcean;
+using namespace osgOcean::BuiltinFFT;
+using namespace osgOcean::SIMD;
+
+namespace
+{
+    /** One pass of a 1D Stockham transform. */
+    template<typename T>
+    struct Stage
+    {
+        int radix;
+        int n;
+        int s;
+        std::vector<T> twiddles;
+    };
+
+    /** Splits an inverse transform of length len into radix-4 passes and at most one radix-2 pass. */
+    template<typename T>
+    void createStages( int len, std::vector< Stage<T> >& stages )
+    {
+        stages.clear();
+
+        int n = len;
+        int s = 1;
+
+        while (n > 1)
+        {
+            Stage<T> stage;
+
+            // an odd power of two needs a single radix-2 pass, do it first
+            stage.radix = ( (n & 0x55555555) == 0 ) ? 2 : 4;
+            stage.n = n;
+            stage.s = s;
+
+            const double theta = 2.0*osg::PI/double(n);
+
+            for (int p = 0; p < n/stage.radix; ++p)
+            {
+                for (int j = 1; j < stage.radix; ++j)
+                {
+                    stage.twiddles.push_back( (T)cos(theta*p*j) );
+                    stage.twiddles.push_back( (T)sin(theta*p*j) );
+                }
+            }
+
+            stages.push_back(stage);
+
+            n /= stage.radix;
+            s *= stage.radix;
+        }
+    }
+
+    /**
+    * Power of two 2D inverse real FFT built from the vertical kernels.
+    * 1. inverse FFT of length N down the N/2+1 columns of the half spectrum
+    * 2. transpose, so that each spectrum row becomes a row of memory
+    * 3. fold the N/2+1 rows into N/2 rows of a half length complex sequence
+    * 4. inverse FFT of length N/2, vectorised across the N columns
+    * 5. transpose back, interleaving the even (real) and odd (imag) outputs
+    */
+    template<typename T>
+    class BuiltinFFTPlan : public FFTPlan<T>
+    {
+    public:
+        typedef typename FFTPlan<T>::complex_type complex_type;
+
+        BuiltinFFTPlan( int size, int numFields, const Kernels<T>& kernels ):
+            FFTPlan<T>  ( size, numFields ),
+            _kernels    ( kernels ),
+            _N          ( size ),
+            _width      ( size/2+1 ),
+            _numSpectrum( size*(size/2+1) ),
+            _numPoints  ( size*size )
+        {
+            _spectra.resize( numFields*_numSpectrum );
+            _fields.resize( numFields*_numPoints );
+
+            _re0.resize( _numSpectrum );
+            _im0.resize( _numSpectrum );
+            _re1.resize( _numSpectrum );
+            _im1.resize( _numSpectrum );
+
+            createStages( _N,   _columnStages );
+            createStages( _N/2, _rowStages );
+
+            const double theta = 2.0*osg::PI/double(_N);
+
+            for (int k = 0; k < _N/2; ++k)
+            {
+                _foldTwiddles.push_back( (T)cos(theta*k) );
+                _foldTwiddles.push_back( (T)sin(theta*k) );
+            }
+        }
+
+        complex_type* getSpectrum( int field ){ return &_spectra[field*_numSpectrum]; }
+
+        T* getField( int field ){ return &_fields[field*_numPoints]; }
+
+        void execute( int numFields )
+        {
+            for (int f = 0; f < numFields; ++f)
+                transform( getSpectrum(f), getField(f) );
+        }
+
+    private:
+        void transform( const complex_type* in, T* out )
+        {
+            T* r  = &_re0[0];
+            T* i  = &_im0[0];
+            T* tr = &_re1[0];
+            T* ti = &_im1[0];
+
+            for (int p = 0; p < _numSpectrum; ++p)
+            {
+                r[p] = in[p].real();
+                i[p] = in[p].imag();
+            }
+
+            // 1. columns
+            runStages( _columnStages, r, i, tr, ti, _width );
+
+            // 2. N x (N/2+1) -> (N/2+1) x N
+            transpose( r,  tr, _N, _width );
+            transpose( i,  ti, _N, _width );
+            std::swap( r, tr );
+            std::swap( i, ti );
+
+            // 3. fold
+            _kernels.fold( r, i, tr, ti, _N/2, _N, &_foldTwiddles[0] );
+            std::swap( r, tr );
+            std::swap( i, ti );
+
+            // 4. rows
+            runStages( _rowStages, r, i, tr, ti, _N );
+
+            // 5. z[m][y] -> out[y][2m], out[y][2m+1]
+            const int halfN = _N/2;
+            const int block = 16;
+
+            for (int m0 = 0; m0 < halfN; m0 += block)
+            {
+                const int m1 = osg::minimum( m0+block, halfN );
+
+                for (int y0 = 0; y0 < _N; y0 += block)
+                {
+                    const int y1 = osg::minimum( y0+block, _N );
+
+                    for (int y = y0; y < y1; ++y)
+                    {
+                        T* row = out + y*_N;
+
+                        for (int m = m0; m < m1; ++m)
+                        {
+                            row[2*m  ] = r[m*_N+y];
+                            row[2*m+1] = i[m*_N+y];
+                        }
+                    }
+                }
+            }
+        }
+
+        void runStages( const std::vector< Stage<T> >& stages, T*& r, T*& i, T*& tr, T*& ti, int rowLen )
+        {
+            for (unsigned int st = 0; st < stages.size(); ++st)
+            {
+                const Stage<T>& stage = stages[st];
+
+                if (stage.radix == 4)
+                    _kernels.radix4( r, i, tr, ti, stage.n, stage.s, rowLen, &stage.twiddles[0] );
+                else
+                    _kernels.radix2( r, i, tr, ti, stage.n, stage.s, rowLen, &stage.twiddles[0] );
+
+                std::swap( r, tr );
+                std::swap( i, ti );
+            }
+        }
+
+        static void transpose( const T* src, T* dst, int rows, int cols )
+        {
+            const int block = 16;
+
+            for (int r0 = 0; r0 < rows; r0 += block)
+            {
+                const int r1 = osg::minimum( r0+block, rows );
+
+                for (int c0 = 0; c0 < cols; c0 += block)
+                {
+                    const int c1 = osg::minimum( c0+block, cols );
+
+                    for (int r = r0; r < r1; ++r)
+                        for (int c = c0; c < c1; ++c)
+                            dst[c*rows+r] = src[r*cols+c];
+                }
+            }
+        }
+
+    private:
+        Kernels<T> _kernels;
+
+        int _N;
+        int _width;
+        int _numSpectrum;
+        int _numPoints;
+
+        std::vector< complex_type > _spectra;
+        std::vector< T > _fields;
+
+        std::vector< T > _re0, _im0, _re1, _im1;   /**< Split complex work arrays */
+
+        std::vector< Stage<T> > _columnStages;
+        std::vector< Stage<T> > _rowStages;
+        std::vector< T > _foldTwiddles;
+    };
+
+    class BuiltinFFTBackend : public FFTBackend
+    {
+    public:
+        BuiltinFFTBackend( const std::string& name, const Kernels<float>& singleKernels, const Kernels<double>& doubleKernels ):
+            _name         ( name ),
+            _singleKernels( singleKernels ),
+            _doubleKernels( doubleKernels )
+        {}
+
+        const char* getName( void ) const { return _name.c_str(); }
+
+        FFTPlan<float>* createSinglePlan( int size, int numFields )
+        {
+            if (!isValidSize(size))
+                return NULL;
+
+            return new BuiltinFFTPlan<float>( size, numFields, _singleKernels );
+        }
+
+        FFTPlan<double>* createDoublePlan( int size, int numFields )
+        {
+            if (!isValidSize(size))
+                return NULL;
+
+            return new BuiltinFFTPlan<double>( size, numFields, _doubleKernels );
+        }
+
+    private:
+        bool isValidSize( int size ) const
+        {
+            if ( size < 2 || (size & (size-1)) != 0 )
+            {
+                osg::notify(osg::WARN) << "osgOcean: built-in FFT only supports power of two sizes, not " << size << "." << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        std::string _name;
+        Kernels<float>  _singleKernels;
+        Kernels<double> _doubleKernels;
+    };
+}
+
+std::vector< osg::ref_ptr<FFTBackend> > osgOcean::BuiltinFFT::createBackends( void )
+{
+    std::vector< osg::ref_ptr<FFTBackend> > backends;
+
+    Kernels<float>  bestSingle = KernelsImpl< ScalarVec<float> >::get("scalar");
+    Kernels<double> bestDouble = KernelsImpl< ScalarVec<double> >::get("scalar");
+
+    backends.push_back( new BuiltinFFTBackend( "builtin-scalar", bestSingle, bestDouble ) );
+
+#ifdef OSGOCEAN_SIMD_SSE2
+    bestSingle = KernelsImpl<SSEFloat>::get("sse2");
+    bestDouble = KernelsImpl<SSEDouble>::get("sse2");
+
+    backends.push_back( new BuiltinFFTBackend( "builtin-sse2", bestSingle, bestDouble ) );
+#endif
+
+#ifdef OSGOCEAN_AVX2
+    if (cpuSupportsAVX2())
+    {
+        bestSingle = getAVX2Kernels( float() );
+        bestDouble = getAVX2Kernels( double() );
+
+        backends.push_back( new BuiltinFFTBackend( "builtin-avx2", bestSingle, bestDouble ) );
+    }
+#endif
+
+    backends.push_back( new BuiltinFFTBackend( "builtin", bestSingle, bestDouble ) );
+
+    osg::notify(osg::INFO) << "osgOcean: built-in FFT using " << bestSingle.name << " kernels." << std::endl;
+
+    return backends;
+}
@@ -0,0 +1,32 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+#include "BuiltinFFTKernels.h"
+#include "SIMD.h"
+
+using namespace osgOcean::BuiltinFFT;
+using namespace osgOcean::SIMD;
+
+Kernels<float> osgOcean::BuiltinFFT::getAVX2Kernels( float )
+{
+    return KernelsImpl<AVXFloat>::get("avx2");
+}
+
+Kernels<double> osgOcean::BuiltinFFT::getAVX2Kernels( double )
+{
+    return KernelsImpl<AVXDouble>::get("avx2");
+}
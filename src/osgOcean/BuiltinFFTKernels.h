@@ -0,0 +1,275 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to the built-in FFT backend (BuiltinFFT.cpp). The kernels are
+// written once against the vector wrappers of SIMD.h and instantiated for
+// scalar, SSE2 and AVX2 code, the latter in BuiltinFFTAVX2.cpp.
+//
+// All passes of the 2D transform are "vertical": a butterfly combines whole
+// rows of split real/imaginary data, so the inner loops run over contiguous
+// memory and vectorise across independent 1D transforms without shuffles.
+
+#pragma once
+#include <osgOcean/FFTBackend>
+
+#include <vector>
+
+namespace osgOcean
+{
+    namespace BuiltinFFT
+    {
+        /** Vertical butterfly passes for one precision and instruction set. */
+        template<typename T>
+        struct Kernels
+        {
+            const char* name;
+
+            /**
+            * One Stockham radix-2 pass over len = n*s rows of width rowLen.
+            * tw holds the (re,im) twiddles w^p of the pass for p < n/2.
+            */
+            void (*radix2)( const T* xr, const T* xi, T* yr, T* yi, int n, int s, int rowLen, const T* tw );
+
+            /** One Stockham radix-4 pass. tw holds w^p, w^2p, w^3p for p < n/4. */
+            void (*radix4)( const T* xr, const T* xi, T* yr, T* yi, int n, int s, int rowLen, const T* tw );
+
+            /**
+            * Folds the N/2+1 rows of a Hermitian half spectrum into the N/2 rows
+            * of a complex sequence whose inverse FFT interleaves the even and
+            * odd real outputs. tw holds w^k for k < N/2.
+            */
+            void (*fold)( const T* xr, const T* xi, T* zr, T* zi, int halfN, int rowLen, const T* tw );
+        };
+
+        /** Kernels for one of the vector wrappers of SIMD.h. */
+        template<class V>
+        struct KernelsImpl
+        {
+            typedef typename V::real_type T;
+            typedef typename V::type      vec;
+
+            static inline void cmul( T& re, T& im, T wr, T wi )
+            {
+                T r = re*wr - im*wi;
+                im  = re*wi + im*wr;
+                re  = r;
+            }
+
+            static inline void vcmul( vec& re, vec& im, const vec& wr, const vec& wi )
+            {
+                vec r = V::sub( V::mul(re,wr), V::mul(im,wi) );
+                im    = V::add( V::mul(re,wi), V::mul(im,wr) );
+                re    = r;
+            }
+
+            static void radix2( const T* xr, const T* xi, T* yr, T* yi, int n, int s, int rowLen, const T* tw )
+            {
+                const int m    = n/2;
+                const int span = s*rowLen;
+
+                for (int p = 0; p < m; ++p)
+                {
+                    const T* ar = xr + (p  )*span;   const T* ai = xi + (p  )*span;
+                    const T* br = xr + (p+m)*span;   const T* bi = xi + (p+m)*span;
+
+                    T* y0r = yr + (2*p  )*span;  T* y0i = yi + (2*p  )*span;
+                    T* y1r = yr + (2*p+1)*span;  T* y1i = yi + (2*p+1)*span;
+
+                    const T wr = tw[2*p], wi = tw[2*p+1];
+                    const vec vwr = V::set1(wr), vwi = V::set1(wi);
+
+                    int i = 0;
+
+                    for (; i+V::width <= span; i += V::width)
+                    {
+                        vec a_r = V::load(ar+i), a_i = V::load(ai+i);
+                        vec b_r = V::load(br+i), b_i = V::load(bi+i);
+
+                        V::store( y0r+i, V::add(a_r,b_r) );
+                        V::store( y0i+i, V::add(a_i,b_i) );
+
+                        vec dr = V::sub(a_r,b_r), di = V::sub(a_i,b_i);
+                        vcmul( dr, di, vwr, vwi );
+
+                        V::store( y1r+i, dr );
+                        V::store( y1i+i, di );
+                    }
+
+                    for (; i < span; ++i)
+                    {
+                        y0r[i] = ar[i]+br[i];
+                        y0i[i] = ai[i]+bi[i];
+
+                        T dr = ar[i]-br[i], di = ai[i]-bi[i];
+                        cmul( dr, di, wr, wi );
+
+                        y1r[i] = dr;
+                        y1i[i] = di;
+                    }
+                }
+            }
+
+            static void radix4( const T* xr, const T* xi, T* yr, T* yi, int n, int s, int rowLen, const T* tw )
+            {
+                const int n0   = n/4;
+                const int span = s*rowLen;
+
+                for (int p = 0; p < n0; ++p)
+                {
+                    const T* ar = xr + (p     )*span;  const T* ai = xi + (p     )*span;
+                    const T* br = xr + (p+  n0)*span;  const T* bi = xi + (p+  n0)*span;
+                    const T* cr = xr + (p+2*n0)*span;  const T* ci = xi + (p+2*n0)*span;
+                    const T* dr = xr + (p+3*n0)*span;  const T* di = xi + (p+3*n0)*span;
+
+                    T* y0r = yr + (4*p  )*span;  T* y0i = yi + (4*p  )*span;
+                    T* y1r = yr + (4*p+1)*span;  T* y1i = yi + (4*p+1)*span;
+                    T* y2r = yr + (4*p+2)*span;  T* y2i = yi + (4*p+2)*span;
+                    T* y3r = yr + (4*p+3)*span;  T* y3i = yi + (4*p+3)*span;
+
+                    const T* w = tw + 6*p;
+                    const bool twiddle = (p != 0);
+
+                    const vec w1r = V::set1(w[0]), w1i = V::set1(w[1]);
+                    const vec w2r = V::set1(w[2]), w2i = V::set1(w[3]);
+                    const vec w3r = V::set1(w[4]), w3i = V::set1(w[5]);
+
+                    int i = 0;
+
+                    for (; i+V::width <= span; i += V::width)
+                    {
+                        vec a_r = V::load(ar+i), a_i = V::load(ai+i);
+                        vec b_r = V::load(br+i), b_i = V::load(bi+i);
+                        vec c_r = V::load(cr+i), c_i = V::load(ci+i);
+                        vec d_r = V::load(dr+i), d_i = V::load(di+i);
+
+                        vec apc_r = V::add(a_r,c_r), apc_i = V::add(a_i,c_i);
+                        vec amc_r = V::sub(a_r,c_r), amc_i = V::sub(a_i,c_i);
+                        vec bpd_r = V::add(b_r,d_r), bpd_i = V::add(b_i,d_i);
+                        vec bmd_r = V::sub(b_r,d_r), bmd_i = V::sub(b_i,d_i);
+
+                        // inverse transform: y1 = amc + i*bmd, y3 = amc - i*bmd
+                        vec t1r = V::sub(amc_r,bmd_i), t1i = V::add(amc_i,bmd_r);
+                        vec t2r = V::sub(apc_r,bpd_r), t2i = V::sub(apc_i,bpd_i);
+                        vec t3r = V::add(amc_r,bmd_i), t3i = V::sub(amc_i,bmd_r);
+
+                        if (twiddle)
+                        {
+                            vcmul( t1r, t1i, w1r, w1i );
+                            vcmul( t2r, t2i, w2r, w2i );
+                            vcmul( t3r, t3i, w3r, w3i );
+                        }
+
+                        V::store( y0r+i, V::add(apc_r,bpd_r) );
+                        V::store( y0i+i, V::add(apc_i,bpd_i) );
+                        V::store( y1r+i, t1r );  V::store( y1i+i, t1i );
+                        V::store( y2r+i, t2r );  V::store( y2i+i, t2i );
+                        V::store( y3r+i, t3r );  V::store( y3i+i, t3i );
+                    }
+
+                    for (; i < span; ++i)
+                    {
+                        T apc_r = ar[i]+cr[i], apc_i = ai[i]+ci[i];
+                        T amc_r = ar[i]-cr[i], amc_i = ai[i]-ci[i];
+                        T bpd_r = br[i]+dr[i], bpd_i = bi[i]+di[i];
+                        T bmd_r = br[i]-dr[i], bmd_i = bi[i]-di[i];
+
+                        T t1r = amc_r-bmd_i, t1i = amc_i+bmd_r;
+                        T t2r = apc_r-bpd_r, t2i = apc_i-bpd_i;
+                        T t3r = amc_r+bmd_i, t3i = amc_i-bmd_r;
+
+                        if (twiddle)
+                        {
+                            cmul( t1r, t1i, w[0], w[1] );
+                            cmul( t2r, t2i, w[2], w[3] );
+                            cmul( t3r, t3i, w[4], w[5] );
+                        }
+
+                        y0r[i] = apc_r+bpd_r;  y0i[i] = apc_i+bpd_i;
+                        y1r[i] = t1r;          y1i[i] = t1i;
+                        y2r[i] = t2r;          y2i[i] = t2i;
+                        y3r[i] = t3r;          y3i[i] = t3i;
+                    }
+                }
+            }
+
+            // With X the half spectrum and Y = X[N/2-k]:
+            //   Z[k] = (X + conj(Y)) + i * w^k * (X - conj(Y))
+            // where z = IFFT(Z) holds the even outputs in the real part and
+            // the odd outputs in the imaginary part.
+            static void fold( const T* xr, const T* xi, T* zr, T* zi, int halfN, int rowLen, const T* tw )
+            {
+                for (int k = 0; k < halfN; ++k)
+                {
+                    const T* ar = xr + k*rowLen;          const T* ai = xi + k*rowLen;
+                    const T* br = xr + (halfN-k)*rowLen;  const T* bi = xi + (halfN-k)*rowLen;
+
+                    T* outr = zr + k*rowLen;
+                    T* outi = zi + k*rowLen;
+
+                    const T wr = tw[2*k], wi = tw[2*k+1];
+                    const vec vwr = V::set1(wr), vwi = V::set1(wi);
+
+                    int i = 0;
+
+                    for (; i+V::width <= rowLen; i += V::width)
+                    {
+                        vec a_r = V::load(ar+i), a_i = V::load(ai+i);
+                        vec b_r = V::load(br+i), b_i = V::load(bi+i);
+
+                        vec er = V::add(a_r,b_r), ei = V::sub(a_i,b_i);
+                        vec or_ = V::sub(a_r,b_r), oi = V::add(a_i,b_i);
+                        vcmul( or_, oi, vwr, vwi );
+
+                        V::store( outr+i, V::sub(er,oi) );
+                        V::store( outi+i, V::add(ei,or_) );
+                    }
+
+                    for (; i < rowLen; ++i)
+                    {
+                        T er = ar[i]+br[i], ei = ai[i]-bi[i];
+                        T or_ = ar[i]-br[i], oi = ai[i]+bi[i];
+                        cmul( or_, oi, wr, wi );
+
+                        outr[i] = er-oi;
+                        outi[i] = ei+or_;
+                    }
+                }
+            }
+
+            static Kernels<T> get( const char* name )
+            {
+                Kernels<T> k;
+                k.name   = name;
+                k.radix2 = &radix2;
+                k.radix4 = &radix4;
+                k.fold   = &fold;
+                return k;
+            }
+        };
+
+        /** AVX2 kernels, defined in BuiltinFFTAVX2.cpp. */
+        Kernels<float>  getAVX2Kernels( float );
+        Kernels<double> getAVX2Kernels( double );
+
+        /**
+        * Creates the built-in backends: one per instruction set usable on this
+        * machine ("builtin-scalar", "builtin-sse2", "builtin-avx2") and "builtin"
+        * for the fastest of them.
+        */
+        std::vector< osg::ref_ptr<FFTBackend> > createBackends( void );
+    }
+}
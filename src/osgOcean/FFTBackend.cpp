@@ -0,0 +1,687 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+#include <osgOcean/FFTBackend>
+#include "BuiltinFFTKernels.h"
+
+#include <osg/Notify>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/ScopedLock>
+
+#include <cstdlib>
+#include <map>
+
+using namespace osgOcean;
+
+// At most one of the external FFT libraries can be compiled in, as FFTSS
+// provides its own fftw_ symbols. The built-in FFT is always available.
+#if defined(USE_FFTW3) || defined(USE_FFTW3F)
+  #include <fftw3.h>
+  #define OSGOCEAN_FFTW
+#elif defined(USE_FFTSS)
+  #include <fftw3compat.h>
+#endif
+
+// Build-time default, set by the OSGOCEAN_FFT_BACKEND CMake option.
+#define OSGOCEAN_STRINGIFY(x) OSGOCEAN_STRINGIFY2(x)
+#define OSGOCEAN_STRINGIFY2(x) #x
+
+namespace
+{
+    /** Presents a plan of one precision as a plan of another. */
+    template<typename T, typename U>
+    class ConvertingFFTPlan : public FFTPlan<T>
+    {
+    public:
+        typedef typename FFTPlan<T>::complex_type complex_type;
+
+        ConvertingFFTPlan( FFTPlan<U>* plan ):
+            FFTPlan<T>  ( plan->getSize(), plan->getNumFields() ),
+            _plan       ( plan ),
+            _numSpectrum( plan->getSize()*plan->getSpectrumWidth() ),
+            _numPoints  ( plan->getSize()*plan->getSize() )
+        {
+            _spectra.resize( plan->getNumFields()*_numSpectrum );
+            _fields.resize( plan->getNumFields()*_numPoints );
+        }
+
+        complex_type* getSpectrum( int field ){ return &_spectra[field*_numSpectrum]; }
+
+        T* getField( int field ){ return &_fields[field*_numPoints]; }
+
+        void execute( int numFields )
+        {
+            for (int f = 0; f < numFields; ++f)
+            {
+                const complex_type* src = getSpectrum(f);
+                std::complex<U>* dst = _plan->getSpectrum(f);
+
+                for (int i = 0; i < _numSpectrum; ++i)
+                    dst[i] = std::complex<U>( (U)src[i].real(), (U)src[i].imag() );
+            }
+
+            _plan->execute(numFields);
+
+            for (int f = 0; f < numFields; ++f)
+            {
+                const U* src = _plan->getField(f);
+                T* dst = getField(f);
+
+                for (int i = 0; i < _numPoints; ++i)
+                    dst[i] = (T)src[i];
+            }
+        }
+
+    private:
+        osg::ref_ptr< FFTPlan<U> > _plan;
+
+        int _numSpectrum;
+        int _numPoints;
+
+        std::vector< complex_type > _spectra;
+        std::vector< T > _fields;
+    };
+
+    /** Cached plan of the given shape that nobody else holds on to, or NULL. */
+    template<typename T>
+    FFTPlan<T>* findUnusedPlan( const std::vector< osg::ref_ptr< FFTPlan<T> > >& plans, int size, int numFields )
+    {
+        for (unsigned int i = 0; i < plans.size(); ++i)
+        {
+            if (plans[i]->getSize() == size && 
+                plans[i]->getNumFields() == numFields && 
+                plans[i]->referenceCount() == 1)
+            {
+                return plans[i].get();
+            }
+        }
+
+        return NULL;
+    }
+
+    /** Drops the cached plans nobody else holds on to, except the first of each shape. */
+    template<typename T>
+    void pruneUnusedPlans( std::vector< osg::ref_ptr< FFTPlan<T> > >& plans )
+    {
+        std::vector< osg::ref_ptr< FFTPlan<T> > > kept;
+
+        for (unsigned int i = 0; i < plans.size(); ++i)
+        {
+            bool duplicate = false;
+
+            for (unsigned int k = 0; k < kept.size() && plans[i]->referenceCount() == 1; ++k)
+            {
+                // kept plans are referenced by both vectors while idle
+                duplicate = duplicate || 
+                    (kept[k]->getSize() == plans[i]->getSize() && 
+                     kept[k]->getNumFields() == plans[i]->getNumFields() &&
+                     kept[k]->referenceCount() == 2);
+            }
+
+            if (!duplicate)
+                kept.push_back( plans[i] );
+        }
+
+        plans.swap( kept );
+    }
+
+#if defined(OSGOCEAN_FFTW)
+    /** The FFTW API of one precision: fftwf_ functions for float, fftw_ for double. */
+    template<typename T> struct FFTW;
+
+  #if defined(USE_FFTW3F)
+    typedef float FFTWReal;
+
+    template<> struct FFTW<float>
+    {
+        typedef fftwf_complex complex;
+        typedef fftwf_plan    plan;
+
+        static const char* name( void ){ return "fftw3f"; }
+
+        static void* alloc( size_t size ){ return fftwf_malloc(size); }
+        static void  release( void* p ){ fftwf_free(p); }
+
+        static plan planManyC2R( const int* dims, int howMany, complex* in, int inDist, float* out, int outDist, unsigned int flags )
+        {
+            return fftwf_plan_many_dft_c2r( 2, dims, howMany, in, NULL, 1, inDist, out, NULL, 1, outDist, flags );
+        }
+
+        static void execute( plan p ){ fftwf_execute(p); }
+        static void destroyPlan( plan p ){ fftwf_destroy_plan(p); }
+
+        static int importWisdom( const char* filename ){ return fftwf_import_wisdom_from_filename(filename); }
+        static int exportWisdom( const char* filename ){ return fftwf_export_wisdom_to_filename(filename); }
+    };
+  #else
+    typedef double FFTWReal;
+
+    template<> struct FFTW<double>
+    {
+        typedef fftw_complex complex;
+        typedef fftw_plan    plan;
+
+        static const char* name( void ){ return "fftw3"; }
+
+        static void* alloc( size_t size ){ return fftw_malloc(size); }
+        static void  release( void* p ){ fftw_free(p); }
+
+        static plan planManyC2R( const int* dims, int howMany, complex* in, int inDist, double* out, int outDist, unsigned int flags )
+        {
+            return fftw_plan_many_dft_c2r( 2, dims, howMany, in, NULL, 1, inDist, out, NULL, 1, outDist, flags );
+        }
+
+        static void execute( plan p ){ fftw_execute(p); }
+        static void destroyPlan( plan p ){ fftw_destroy_plan(p); }
+
+        static int importWisdom( const char* filename ){ return fftw_import_wisdom_from_filename(filename); }
+        static int exportWisdom( const char* filename ){ return fftw_export_wisdom_to_filename(filename); }
+    };
+  #endif
+
+    // The FFTW planner is not thread safe, only fftw_execute is.
+    OpenThreads::Mutex s_fftwPlannerMutex;
+
+    /** Must be called with s_fftwPlannerMutex held. Reads filename the first time it is used. */
+    template<typename T>
+    void loadFFTWWisdom( const std::string& filename )
+    {
+        static std::string loaded;
+
+        if (filename.empty() || filename == loaded)
+            return;
+
+        loaded = filename;
+
+        if (FFTW<T>::importWisdom( filename.c_str() ))
+            osg::notify(osg::INFO) << "osgOcean: Loaded FFTW wisdom from '" << filename << "'." << std::endl;
+        else
+            osg::notify(osg::INFO) << "osgOcean: No FFTW wisdom in '" << filename << "' yet." << std::endl;
+    }
+
+    unsigned int getFFTWFlags( FFTBackend::PlanningRigor rigor )
+    {
+        switch (rigor)
+        {
+        case FFTBackend::PLAN_MEASURE: return FFTW_MEASURE;
+        case FFTBackend::PLAN_PATIENT: return FFTW_PATIENT;
+        default:                       return FFTW_ESTIMATE;
+        }
+    }
+
+    /** Batched c2r plans, one per batch size so that any prefix of the fields can be transformed. */
+    template<typename T>
+    class FFTWPlan : public FFTPlan<T>
+    {
+    private:
+        typedef FFTW<T> API;
+        typedef typename API::complex fftw_complex_type;
+        typedef typename API::plan    fftw_plan_type;
+
+    public:
+        typedef typename FFTPlan<T>::complex_type complex_type;
+
+        FFTWPlan( int size, int numFields, FFTBackend::PlanningRigor rigor, const std::string& wisdomFile ):
+            FFTPlan<T>  ( size, numFields ),
+            _numSpectrum( size*(size/2+1) ),
+            _numPoints  ( size*size )
+        {
+            // The FFTW docs advise to use fftw_malloc for the alignment guarantees
+            _spectra = (fftw_complex_type*)API::alloc( numFields*_numSpectrum*sizeof(fftw_complex_type) );
+            _fields  = (T*)API::alloc( numFields*_numPoints*sizeof(T) );
+
+            const int dims[2] = { size, size };
+            const unsigned int flags = getFFTWFlags( rigor );
+
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_fftwPlannerMutex);
+
+            loadFFTWWisdom<T>( wisdomFile );
+
+            bool measured = false;
+
+            for (int n = 1; n <= numFields; ++n)
+            {
+                fftw_plan_type plan = NULL;
+
+                // Reuse what was measured before, in this run or a previous one
+                if (flags != FFTW_ESTIMATE)
+                    plan = API::planManyC2R( dims, n, _spectra, _numSpectrum, _fields, _numPoints, flags | FFTW_WISDOM_ONLY );
+
+                if (!plan)
+                {
+                    plan = API::planManyC2R( dims, n, _spectra, _numSpectrum, _fields, _numPoints, flags );
+
+                    measured = measured || (flags != FFTW_ESTIMATE);
+                }
+
+                _plans.push_back( plan );
+            }
+
+            if (measured && !wisdomFile.empty())
+            {
+                if (!API::exportWisdom( wisdomFile.c_str() ))
+                    osg::notify(osg::WARN) << "osgOcean: Unable to write FFTW wisdom to '" << wisdomFile << "'." << std::endl;
+            }
+        }
+
+        complex_type* getSpectrum( int field ){ return reinterpret_cast<complex_type*>( _spectra + field*_numSpectrum ); }
+
+        T* getField( int field ){ return _fields + field*_numPoints; }
+
+        void execute( int numFields )
+        {
+            API::execute( _plans[numFields-1] );
+        }
+
+    protected:
+        ~FFTWPlan( void )
+        {
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_fftwPlannerMutex);
+
+                for (unsigned int i = 0; i < _plans.size(); ++i)
+                    API::destroyPlan( _plans[i] );
+            }
+
+            API::release( _spectra );
+            API::release( _fields );
+        }
+
+    private:
+        int _numSpectrum;
+        int _numPoints;
+
+        fftw_complex_type* _spectra;
+        T* _fields;
+
+        std::vector< fftw_plan_type > _plans;
+    };
+
+    /** Plans of the precision of the FFTW library built in, createPlan() converts to the other. */
+    class FFTWBackend : public FFTBackend
+    {
+    public:
+        const char* getName( void ) const { return FFTW<FFTWReal>::name(); }
+
+  #if defined(USE_FFTW3F)
+        FFTPlan<float>* createSinglePlan( int size, int numFields )
+  #else
+        FFTPlan<double>* createDoublePlan( int size, int numFields )
+  #endif
+        { 
+            return new FFTWPlan<FFTWReal>( size, numFields, getPlanningRigor(), getWisdomFile() ); 
+        }
+    };
+
+#elif defined(USE_FFTSS)
+    /**
+    * FFTSS has no real-output transforms. Instead two real fields are packed
+    * into the real and imaginary parts of one complex transform (Z = A + iB),
+    * which works because both spectra are Hermitian.
+    */
+    class FFTSSPlan : public FFTPlan<double>
+    {
+    public:
+        FFTSSPlan( int size, int numFields ):
+            FFTPlan<double>( size, numFields ),
+            _N          ( size ),
+            _width      ( size/2+1 ),
+            _numSpectrum( size*(size/2+1) ),
+            _numPoints  ( size*size )
+        {
+            _spectra.resize( numFields*_numSpectrum );
+            _fields.resize( numFields*_numPoints );
+
+            _complexData = (fftw_complex*)fftw_malloc( _numPoints*sizeof(fftw_complex) );
+            _realData    = (fftw_complex*)fftw_malloc( _numPoints*sizeof(fftw_complex) );
+
+            _fftPlan = fftw_plan_dft_2d( _N, _N, _complexData, _realData, FFTW_BACKWARD, FFTW_ESTIMATE );
+        }
+
+        complex_type* getSpectrum( int field ){ return &_spectra[field*_numSpectrum]; }
+
+        double* getField( int field ){ return &_fields[field*_numPoints]; }
+
+        void execute( int numFields )
+        {
+            for (int f = 0; f < numFields; f += 2)
+            {
+                const complex_type* a = getSpectrum(f);
+                const complex_type* b = (f+1 < numFields) ? getSpectrum(f+1) : NULL;
+
+                for (int y = 0; y < _N; ++y)
+                {
+                    for (int x = 0; x < _N; ++x)
+                    {
+                        // rebuild the redundant half from h(-k) = conj(h(k))
+                        complex_type A, B;
+
+                        if (x < _width)
+                        {
+                            int ptr = y*_width+x;
+                            A = a[ptr];
+                            B = b ? b[ptr] : complex_type(0.0,0.0);
+                        }
+                        else
+                        {
+                            int ptr = ((_N-y)%_N)*_width+(_N-x);
+                            A = conj( a[ptr] );
+                            B = b ? conj( b[ptr] ) : complex_type(0.0,0.0);
+                        }
+
+                        fftw_complex& in = _complexData[y*_N+x];
+                        in[0] = A.real() - B.imag();
+                        in[1] = A.imag() + B.real();
+                    }
+                }
+
+                fftw_execute(_fftPlan);
+
+                double* fa = getField(f);
+                double* fb = b ? getField(f+1) : NULL;
+
+                for (int i = 0; i < _numPoints; ++i)
+                {
+                    fa[i] = _realData[i][0];
+
+                    if (fb)
+                        fb[i] = _realData[i][1];
+                }
+            }
+        }
+
+    protected:
+        ~FFTSSPlan( void )
+        {
+            fftw_destroy_plan( _fftPlan );
+
+            fftw_free( _complexData );
+            fftw_free( _realData );
+        }
+
+    private:
+        int _N;
+        int _width;
+        int _numSpectrum;
+        int _numPoints;
+
+        std::vector< complex_type > _spectra;
+        std::vector< double > _fields;
+
+        fftw_complex* _complexData;    /**< Packed 2D complex FFT input */
+        fftw_complex* _realData;       /**< Packed 2D complex FFT output */
+        fftw_plan _fftPlan;
+    };
+
+    class FFTSSBackend : public FFTBackend
+    {
+    public:
+        const char* getName( void ) const { return "fftss"; }
+
+        FFTPlan<double>* createDoublePlan( int size, int numFields ){ return new FFTSSPlan( size, numFields ); }
+    };
+#endif
+
+    typedef std::map< std::string, osg::ref_ptr<FFTBackend> > BackendMap;
+
+    OpenThreads::Mutex s_registryMutex;
+    std::string s_defaultBackend;
+
+    bool s_planningRigorSet = false;
+    FFTBackend::PlanningRigor s_planningRigor = FFTBackend::PLAN_ESTIMATE;
+
+    bool s_wisdomFileSet = false;
+    std::string s_wisdomFile;
+
+    /** Must be called with s_registryMutex held. */
+    BackendMap& getRegistry( void )
+    {
+        static BackendMap registry;
+        static bool initialised = false;
+
+        if (!initialised)
+        {
+            initialised = true;
+
+            std::vector< osg::ref_ptr<FFTBackend> > builtins = BuiltinFFT::createBackends();
+
+            for (unsigned int i = 0; i < builtins.size(); ++i)
+                registry[ builtins[i]->getName() ] = builtins[i];
+
+#if defined(OSGOCEAN_FFTW)
+            osg::ref_ptr<FFTBackend> library = new FFTWBackend;
+            registry[ library->getName() ] = library;
+#elif defined(USE_FFTSS)
+            osg::ref_ptr<FFTBackend> library = new FFTSSBackend;
+            registry[ library->getName() ] = library;
+#endif
+        }
+
+        return registry;
+    }
+}
+
+osg::ref_ptr< FFTPlan<float> > FFTBackend::createPlan( int size, int numFields, float )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_planCacheMutex);
+
+    // Taken while the lock is held, so no other thread can see it unused
+    osg::ref_ptr< FFTPlan<float> > plan = findUnusedPlan( _singlePlans, size, numFields );
+
+    if (plan.valid())
+        return plan;
+
+    plan = createSinglePlan( size, numFields );
+
+    if (!plan.valid())
+    {
+        FFTPlan<double>* doublePlan = createDoublePlan( size, numFields );
+
+        if (doublePlan)
+            plan = new ConvertingFFTPlan<float,double>( doublePlan );
+    }
+
+    if (plan.valid())
+        _singlePlans.push_back( plan );
+
+    return plan;
+}
+
+osg::ref_ptr< FFTPlan<double> > FFTBackend::createPlan( int size, int numFields, double )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_planCacheMutex);
+
+    osg::ref_ptr< FFTPlan<double> > plan = findUnusedPlan( _doublePlans, size, numFields );
+
+    if (plan.valid())
+        return plan;
+
+    plan = createDoublePlan( size, numFields );
+
+    if (!plan.valid())
+    {
+        FFTPlan<float>* singlePlan = createSinglePlan( size, numFields );
+
+        if (singlePlan)
+            plan = new ConvertingFFTPlan<double,float>( singlePlan );
+    }
+
+    if (plan.valid())
+        _doublePlans.push_back( plan );
+
+    return plan;
+}
+
+void FFTBackend::clearPlanCache( void )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_planCacheMutex);
+
+    _singlePlans.clear();
+    _doublePlans.clear();
+}
+
+void FFTBackend::releaseUnusedPlans( void )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_planCacheMutex);
+
+    pruneUnusedPlans( _singlePlans );
+    pruneUnusedPlans( _doublePlans );
+}
+
+void FFTBackend::registerBackend( FFTBackend* backend )
+{
+    if (!backend)
+        return;
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+    getRegistry()[ backend->getName() ] = backend;
+}
+
+FFTBackend* FFTBackend::getBackend( const std::string& name )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+
+    BackendMap& registry = getRegistry();
+    BackendMap::iterator itr = registry.find(name);
+
+    return itr != registry.end() ? itr->second.get() : NULL;
+}
+
+std::vector<std::string> FFTBackend::getBackendNames( void )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+
+    std::vector<std::string> names;
+
+    BackendMap& registry = getRegistry();
+
+    for (BackendMap::iterator itr = registry.begin(); itr != registry.end(); ++itr)
+        names.push_back( itr->first );
+
+    return names;
+}
+
+bool FFTBackend::setDefaultBackend( const std::string& name )
+{
+    if (!getBackend(name))
+    {
+        osg::notify(osg::WARN) << "osgOcean: FFT backend '" << name << "' is not available." << std::endl;
+        return false;
+    }
+
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+    s_defaultBackend = name;
+    return true;
+}
+
+FFTBackend* FFTBackend::getDefaultBackend( void )
+{
+    std::vector<std::string> candidates;
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+        candidates.push_back( s_defaultBackend );
+    }
+
+    const char* env = getenv("OSGOCEAN_FFT_BACKEND");
+    candidates.push_back( env ? env : "" );
+
+#ifdef OSGOCEAN_FFT_BACKEND
+    candidates.push_back( OSGOCEAN_STRINGIFY(OSGOCEAN_FFT_BACKEND) );
+#endif
+
+    candidates.push_back( "builtin" );
+
+    for (unsigned int i = 0; i < candidates.size(); ++i)
+    {
+        if (candidates[i].empty())
+            continue;
+
+        FFTBackend* backend = getBackend( candidates[i] );
+
+        if (backend)
+            return backend;
+
+        osg::notify(osg::WARN) << "osgOcean: FFT backend '" << candidates[i] << "' is not available." << std::endl;
+    }
+
+    return NULL;
+}
+
+void FFTBackend::setPlanningRigor( PlanningRigor rigor )
+{
+    std::vector< osg::ref_ptr<FFTBackend> > backends;
+
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+
+        s_planningRigorSet = true;
+        s_planningRigor = rigor;
+
+        BackendMap& registry = getRegistry();
+
+        for (BackendMap::iterator itr = registry.begin(); itr != registry.end(); ++itr)
+            backends.push_back( itr->second );
+    }
+
+    for (unsigned int i = 0; i < backends.size(); ++i)
+        backends[i]->clearPlanCache();
+}
+
+FFTBackend::PlanningRigor FFTBackend::getPlanningRigor( void )
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+
+        if (s_planningRigorSet)
+            return s_planningRigor;
+    }
+
+    const char* env = getenv("OSGOCEAN_FFT_PLANNING");
+    const std::string rigor = env ? env : "";
+
+    if (rigor == "measure")
+        return PLAN_MEASURE;
+
+    if (rigor == "patient")
+        return PLAN_PATIENT;
+
+    if (!rigor.empty() && rigor != "estimate")
+        osg::notify(osg::WARN) << "osgOcean: Unknown FFT planning rigor '" << rigor << "'." << std::endl;
+
+    return PLAN_ESTIMATE;
+}
+
+void FFTBackend::setWisdomFile( const std::string& filename )
+{
+    OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+
+    s_wisdomFileSet = true;
+    s_wisdomFile = filename;
+}
+
+std::string FFTBackend::getWisdomFile( void )
+{
+    {
+        OpenThreads::ScopedLock<OpenThreads::Mutex> lock(s_registryMutex);
+
+        if (s_wisdomFileSet)
+            return s_wisdomFile;
+    }
+
+    const char* env = getenv("OSGOCEAN_FFT_WISDOM");
+    return env ? env : "";
+}
@@ -52,7 +52,7 @@ FFTOceanSurface::FFTOceanSurface( unsigned int FFTGridSize,
     ,_activeNormals  ( new osg::Vec3Array )
     ,_totalPoints    ( _tileSize * _numTiles + 1 )
 {
-    setUserData( new OceanDataType(*this, _NUMFRAMES, 25) );
+    setUserData( new OceanDataType(*this, _NUMFRAMES) );
     setOceanAnimationCallback( new OceanAnimationCallback );
 }
 
@@ -67,23 +67,48 @@ FFTOceanSurface::FFTOceanSurface( const FFTOceanSurface& copy, const osg::CopyOp
 
 FFTOceanSurface::~FFTOceanSurface(void)
 {
+    // the live simulation writes to _mipmapData through computeFrame()
+    stopLiveSimulation();
 }
 
 void FFTOceanSurface::build( void )
 {
     osg::notify(osg::INFO) << "FFTOceanSurface::build()" << std::endl;
 
-    computeSea( _NUMFRAMES );
+    cancelRebuild();
+    computeSea( _isLive ? (unsigned int)LIVE_FRAMES : _NUMFRAMES );
+    buildGeometry(0);
+
+    _isDirty =  false;
+
+    osg::notify(osg::INFO) << "FFTOceanSurface::build() Complete." << std::endl;
+}
+
+void FFTOceanSurface::buildGeometry( unsigned int frame )
+{
     createOceanTiles();
-    computeVertices(0);
+    computeVertices(frame);
     computePrimitives();
 
     initStateSet();
 
-    _isDirty =  false;
     _isStateDirty = false;
+}
 
-    osg::notify(osg::INFO) << "FFTOceanSurface::build() Complete." << std::endl;
+void FFTOceanSurface::swapFrames( FFTOceanTechnique& other )
+{
+    FFTOceanTechnique::swapFrames( other );
+
+    // other is a copy of this surface, see FFTOceanTechnique::startRebuild()
+    _mipmapData.swap( static_cast<FFTOceanSurface&>(other)._mipmapData );
+}
+
+const OceanTile* FFTOceanSurface::getSurfaceTile( unsigned int frame ) const
+{
+    if (_mipmapData.empty())
+        return NULL;
+
+    return &_mipmapData[ frame % _mipmapData.size() ][0];
 }
 
 void FFTOceanSurface::initStateSet( void )
@@ -107,6 +132,12 @@ void FFTOceanSurface::initStateSet( void )
     _stateset->addUniform( new osg::Uniform("osgOcean_FoamCapTop",      _foamCapTop ) );
     _stateset->addUniform( new osg::Uniform("osgOcean_FoamMap",         FOAM_MAP ) );
     _stateset->addUniform( new osg::Uniform("osgOcean_FoamScale",       _tileResInv*30.f ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_EnableJacobianFoam", _useJacobianFoam && _jacobianMaps.valid() ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_FoamJacobianBottom", _foamJacobianBottom ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_FoamJacobianTop",    _foamJacobianTop ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_JacobianMap",        JACOBIAN_MAP ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_JacobianFrame",      float(_oldFrame) ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_JacobianCoords",     computeJacobianCoords() ) );
 
     if( _useCrestFoam )
     {
@@ -115,6 +146,29 @@ void FFTOceanSurface::initStateSet( void )
             _stateset->setTextureAttributeAndModes( FOAM_MAP, foam_tex, osg::StateAttribute::ON );
     }
 
+    if( _useCrestFoam && _useJacobianFoam && _jacobianMaps.valid() )
+    {
+        if (ShaderManager::instance().areShadersEnabled())
+            _stateset->setTextureAttributeAndModes( JACOBIAN_MAP, _jacobianMaps.get(), osg::StateAttribute::ON );
+    }
+
+    // Detail cascades, tiled at their own lengths over the jacobian map coords
+    osg::Uniform* cascadeScales = new osg::Uniform( osg::Uniform::FLOAT, "osgOcean_CascadeScales", MAX_CASCADES );
+
+    for (unsigned int c = 0; c < getNumCascades(); ++c)
+        cascadeScales->setElement( c, (float)_tileResolution / getCascadeResolution(c) );
+
+    _stateset->addUniform( cascadeScales );
+    _stateset->addUniform( new osg::Uniform("osgOcean_CascadeMap",   CASCADE_MAP ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_NumCascades",  _cascadeMaps.valid() ? (int)getNumCascades() : 0 ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_CascadeLayer", float(_oldFrame*getNumCascades()) ) );
+
+    if( _cascadeMaps.valid() )
+    {
+        if (ShaderManager::instance().areShadersEnabled())
+            _stateset->setTextureAttributeAndModes( CASCADE_MAP, _cascadeMaps.get(), osg::StateAttribute::ON );
+    }
+
     // Noise
     _stateset->addUniform( new osg::Uniform("osgOcean_NoiseMap",     NORMAL_MAP ) );
     _stateset->addUniform( new osg::Uniform("osgOcean_NoiseCoords0", computeNoiseCoords( 32.f, osg::Vec2f( 2.f, 4.f), 2.f, 0.f ) ) );
@@ -161,13 +215,15 @@ osg::ref_ptr<osg::Texture2D> FFTOceanSurface::createNoiseMap(unsigned int size,
                                                              float waveScale,
                                                              float tileResolution )
 {
-    osg::ref_ptr<osg::FloatArray> heights = new osg::FloatArray;
+    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array;
 
-    FFTSimulation noiseFFT(size, windDir, windSpeed, _depth, _reflDampFactor, waveScale, tileResolution, 10.f);
+    // complemented seed so that the noise does not repeat the waves of the geometry
+    FFTSimulation noiseFFT(size, windDir, windSpeed, _depth, _reflDampFactor, waveScale, tileResolution, 10.f, NULL, ~_seed);
     noiseFFT.setTime(0.f);
-    noiseFFT.computeHeights(heights.get());
+    noiseFFT.computeTile(vertices.get(), 0.f, false, 0.f, normals.get());
         
-    OceanTile oceanTile(heights.get(),size,tileResolution/size);
+    OceanTile oceanTile(vertices.get(),normals.get(),size,tileResolution/size);
 
     return oceanTile.createNormalMap();
 }
@@ -178,62 +234,136 @@ void FFTOceanSurface::computeSea( unsigned int totalFrames )
     osg::notify(osg::INFO) << "Mipmap Levels: " << _numLevels << std::endl;
     osg::notify(osg::INFO) << "Highest Resolution: " << _tileSize << std::endl;
 
-    FFTSimulation FFTSim( _tileSize, _windDirection, _windSpeed, _depth, _reflDampFactor, _waveScale, _tileResolution, _cycleTime );
-
     // clear previous mipmaps (if any)
+    stopLiveSimulation();
     _mipmapData.clear();
     _mipmapData.resize( totalFrames );
 
-    _averageHeight = 0.f;
-    _maxHeight = -FLT_MAX;
+    // the jacobian only varies where the surface is displaced
+    if (_isChoppy)
+        createJacobianMaps( totalFrames );
+    else
+        _jacobianMaps = NULL;
 
-    for( unsigned int frame = 0; frame < totalFrames; ++frame )
-    {
-        osg::ref_ptr<osg::FloatArray> heights = new osg::FloatArray;
-        osg::ref_ptr<osg::Vec2Array> displacements = NULL;
+    createSurfaceMotion( totalFrames );
+    createLevelErrors( totalFrames );
+
+    // only the first live frame is known up front, the others are being computed
+    unsigned int knownFrames = totalFrames;
+
+    std::vector<OceanTile> cachedTiles;
 
-        if (_isChoppy)
-            displacements = new osg::Vec2Array;
+    if (readFrameCache( totalFrames, _numLevels, cachedTiles ))
+    {
+        for( unsigned int frame = 0; frame < totalFrames; ++frame )
+            _mipmapData[frame].assign( cachedTiles.begin() + frame*_numLevels, cachedTiles.begin() + (frame+1)*_numLevels );
+    }
+    else
+    {
+        FFTSimulation FFTSim( _tileSize, _windDirection, _windSpeed, _depth, _reflDampFactor, _waveScale, _tileResolution, getSimulationLoopTime(), NULL, _seed );
 
-        float time = _cycleTime * ( float(frame) / float(totalFrames) );
+        if (_isLive)
+        {
+            startLiveSimulation( FFTSim );
+            knownFrames = 1;
+        }
+        else
+        {
+            bakeFrames( FFTSim, totalFrames );
+        }
 
-        FFTSim.setTime( time );
-        FFTSim.computeHeights( heights.get() );
+        if (!_isLive && !_frameCacheDirectory.empty())
+        {
+            std::vector<const OceanTile*> tiles;
 
-        if(_isChoppy)
-            FFTSim.computeDisplacements( _choppyFactor, displacements.get() );
+            for( unsigned int frame = 0; frame < totalFrames; ++frame )
+            {
+                for( unsigned int level = 0; level < _numLevels; ++level )
+                    tiles.push_back( &_mipmapData[frame][level] );
+            }
 
-        _mipmapData[frame].resize( _numLevels );
+            writeFrameCache( totalFrames, _numLevels, tiles );
+        }
+    }
 
-        // Level 0
-        _mipmapData[frame][0] = OceanTile( heights.get(), _tileSize, _pointSpacing, displacements.get() );
+    // Summed in frame order so that the result does not depend on the threads
+    _averageHeight = 0.f;
+    _maxHeight = -FLT_MAX;
 
+    for( unsigned int frame = 0; frame < knownFrames; ++frame )
+    {
         _averageHeight += _mipmapData[frame][0].getAverageHeight();
 
         _maxHeight = osg::maximum(_maxHeight, _mipmapData[frame][0].getMaximumHeight());
+    }
 
-        // Levels 1 -> Max Level
-        for(unsigned int level = 1; level < _numLevels-1; ++level )
-        {
-            OceanTile& lastTile = _mipmapData[frame][level-1];
+    _averageHeight /= (float)knownFrames;
 
-            _mipmapData[frame][level] = OceanTile( lastTile, _tileSize >> level, _tileSize/(_tileSize>>level)*_pointSpacing );
-        }
+    computeLevelErrors( knownFrames );
+
+    osg::notify(osg::INFO) << "Average Height: " << _averageHeight << std::endl;
+    osg::notify(osg::INFO) << "FFTOceanSurface::computeSea() Complete." << std::endl;
+}
+
+void FFTOceanSurface::computeFrame( FFTSimulation& sim, unsigned int frame, float time )
+{
+    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array;
+    osg::ref_ptr<osg::FloatArray> jacobians = NULL;
+    osg::ref_ptr<osg::Vec3Array> velocities = NULL;
+    osg::ref_ptr<osg::Vec3Array> accelerations = NULL;
 
-        // Used for lowest resolution tile
-        osg::ref_ptr<osg::FloatArray> zeroHeights = new osg::FloatArray(4);
-        zeroHeights->at(0) = 0.f;
-        zeroHeights->at(1) = 0.f;
-        zeroHeights->at(2) = 0.f;
-        zeroHeights->at(3) = 0.f;
+    if (_isChoppy)
+        jacobians = new osg::FloatArray;
 
-        _mipmapData[frame][_numLevels-1] = OceanTile( zeroHeights.get(), 1, _tileSize/(_tileSize>>(_numLevels-1))*_pointSpacing );
+    if (_computeMotion)
+    {
+        velocities = new osg::Vec3Array;
+        accelerations = new osg::Vec3Array;
     }
 
-    _averageHeight /= (float)totalFrames;
+    sim.setTime( time );
 
-    osg::notify(osg::INFO) << "Average Height: " << _averageHeight << std::endl;
-    osg::notify(osg::INFO) << "FFTOceanSurface::computeSea() Complete." << std::endl;
+    // vertices, normals and jacobians are written straight from a single batched transform
+    // tile vertices only carry the displacement, their grid position is added when drawn
+    sim.computeTile( vertices.get(), 0.f, _isChoppy, _choppyFactor, normals.get(), jacobians.get(), velocities.get(), accelerations.get() );
+
+    if (jacobians.valid())
+        setJacobianMap( frame, jacobians.get() );
+
+    if (velocities.valid())
+        setSurfaceMotion( frame, velocities.get(), accelerations.get() );
+
+    _mipmapData[frame].resize( _numLevels );
+
+    // Level 0
+    _mipmapData[frame][0] = OceanTile( vertices.get(), normals.get(), _tileSize, _pointSpacing, false );
+
+    // Levels 1 -> Max Level
+    OceanTile::buildMipmaps( &_mipmapData[frame][0], _numLevels-1 );
+
+    // Used for lowest resolution tile
+    osg::ref_ptr<osg::FloatArray> zeroHeights = new osg::FloatArray(4);
+    zeroHeights->at(0) = 0.f;
+    zeroHeights->at(1) = 0.f;
+    zeroHeights->at(2) = 0.f;
+    zeroHeights->at(3) = 0.f;
+
+    _mipmapData[frame][_numLevels-1] = OceanTile( zeroHeights.get(), 1, _tileSize/(_tileSize>>(_numLevels-1))*_pointSpacing );
+
+    // geometric error of every level against level 0, see computeMinDistances()
+    for(unsigned int level = 1; level < _numLevels; ++level )
+    {
+        _mipmapData[frame][level].computeMaxDelta( _mipmapData[frame][0] );
+        setLevelError( frame, level, _mipmapData[frame][level].getMaxDelta() );
+    }
+
+    // packed once all levels are down sampled from full precision
+    if (shouldPackFrames())
+    {
+        for(unsigned int level = 0; level < _numLevels; ++level )
+            _mipmapData[frame][level].pack();
+    }
 }
 
 void FFTOceanSurface::createOceanTiles( void )
@@ -250,7 +380,6 @@ void FFTOceanSurface::createOceanTiles( void )
     _mipmapGeom.clear();
     _activeVertices->clear();
     _activeNormals->clear();
-    _minDist.clear();
 
     if(getNumDrawables()>0)
         removeDrawables(0,getNumDrawables());
@@ -309,20 +438,6 @@ void FFTOceanSurface::createOceanTiles( void )
     _activeVertices->resize( _numVertices );
     _activeNormals->resize( _numVertices );
 
-// Correct dMin calculations for geomipmap distances. Not used at the moment
-//    float T = (2.0f * TRESHOLD) / VRES;
-//    float A = 1.0f / (float)tan(FOV / 2.0f);
-//    float C = A / T;
-
-    osg::notify(osg::INFO) << "Minimum Distances: " << std::endl;
-
-    for(unsigned int d = 0; d < _numLevels; ++d)
-    {
-        _minDist.push_back( d * (float(_tileResolution+1)) + ( float(_tileResolution+1.f)*0.5f ) );
-        _minDist.back() *= _minDist.back();
-        osg::notify(osg::INFO) << d << ": " << sqrt(_minDist.back()) << std::endl;
-    }
-
     osg::notify(osg::INFO) << "FFTOceanSurface::createOceanTiles() Complete." << std::endl;
 }
 
@@ -342,6 +457,9 @@ void FFTOceanSurface::computeVertices( unsigned int frame )
     unsigned int ptr = 0;
 
     const std::vector<OceanTile>& curData = _mipmapData[frame];
+    const std::vector<OceanTile>& nextData = _mipmapData[ (frame+1) % _mipmapData.size() ];
+
+    const float blend = getFrameBlend();
 
     for(unsigned int y = 0; y < _numTiles; ++y )
     {    
@@ -353,6 +471,7 @@ void FFTOceanSurface::computeVertices( unsigned int frame )
 
             MipmapGeometry* tile = getTile(x,y);
             const OceanTile& data = curData[ tile->getLevel() ];
+            const OceanTile& next = nextData[ tile->getLevel() ];
 
             for(unsigned int row = 0; row < tile->getColLen(); ++row )
             {
@@ -362,8 +481,19 @@ void FFTOceanSurface::computeVertices( unsigned int frame )
                 {
                     vertexOffset.x() = data.getSpacing()*float(col) + tileOffset.x();
 
-                    (*_activeVertices)[ptr] = data.getVertex(col,row) + vertexOffset;
-                    (*_activeNormals) [ptr] = data.getNormal(col,row);
+                    if (blend > 0.f)
+                    {
+                        osg::Vec3f normal = data.getNormal(col,row)*(1.f-blend) + next.getNormal(col,row)*blend;
+                        normal.normalize();
+
+                        (*_activeVertices)[ptr] = data.getVertex(col,row)*(1.f-blend) + next.getVertex(col,row)*blend + vertexOffset;
+                        (*_activeNormals) [ptr] = normal;
+                    }
+                    else
+                    {
+                        (*_activeVertices)[ptr] = data.getVertex(col,row) + vertexOffset;
+                        (*_activeNormals) [ptr] = data.getNormal(col,row);
+                    }
                     ++ptr;
                 }
             }
@@ -373,11 +503,20 @@ void FFTOceanSurface::computeVertices( unsigned int frame )
 
 void FFTOceanSurface::update( unsigned int frame, const double& dt, const osg::Vec3f& eye )
 {
-    if(_isDirty)
+    // a finished background rebuild is swapped in between frames
+    if(finishRebuild())
+        buildGeometry(frame);
+
+    // the current sea is shown until a background rebuild is done
+    if(_isDirty && (_mipmapData.empty() || !startRebuild()))
         build();
     else if(_isStateDirty)
         initStateSet();
 
+    // the live simulation keeps its own time, frame only counts the baked cycle
+    if (_isLive)
+        frame = getLiveFrame( dt );
+
     if (_isAnimating)
     {
         static double time = 0.0;
@@ -391,15 +530,24 @@ void FFTOceanSurface::update( unsigned int frame, const double& dt, const osg::V
         getStateSet()->getUniform("osgOcean_NoiseCoords0")->set( computeNoiseCoords( 32.f, osg::Vec2f( 2.f, 4.f), 2.f, time ) );
         getStateSet()->getUniform("osgOcean_NoiseCoords1")->set( computeNoiseCoords( 8.f,  osg::Vec2f(-4.f, 2.f), 1.f, time ) );
 
+        // live frames are swapped into the first layers of the maps
+        const unsigned int layer = _isLive ? 0 : frame;
+
+        getStateSet()->getUniform("osgOcean_JacobianFrame")->set( float(layer) );
+        getStateSet()->getUniform("osgOcean_CascadeLayer")->set( float(layer*getNumCascades()) );
+
         if( updateMipmaps( eye, frame ) )
         {
             computeVertices( frame );
             computePrimitives();
         }
-        else if( frame != _oldFrame )
+        else if( frame != _oldFrame || getFrameBlend() > 0.f )
         {
             computeVertices( frame );
         }
+
+        // the tile lattice follows the eye when endless
+        getStateSet()->getUniform("osgOcean_JacobianCoords")->set( computeJacobianCoords() );
     }
 
     _oldFrame = frame;
@@ -407,45 +555,21 @@ void FFTOceanSurface::update( unsigned int frame, const double& dt, const osg::V
 
 float FFTOceanSurface::getSurfaceHeightAt(float x, float y, osg::Vec3f* normal)
 {
-    if(_isDirty)
-        build();
-
-    // Initialize normal so it's in a "known" state if we can't calculate it later.
-    if (normal != 0)
-    {
-        normal->set(0, 0, 1);
-    }
-
-    // ocean surface coordinates
-    float oceanX, oceanY;
-
-    // translate x, y to oceanSurface origin coordinates
-    oceanX = -_startPos.x() + x;
-    oceanY =  _startPos.y() - y;
-
-    // calculate the corresponding tile on the ocean surface
-    unsigned int ix = oceanX/_tileResolution;
-    unsigned int iy = oceanY/_tileResolution;
-
-    unsigned int frame = _oldFrame;
-
-    // Test if the tile is valid 
-    if (ix < _numTiles && iy < _numTiles)
-    {
-        const OceanTile& data = _mipmapData[_oldFrame][0];
-
-        float tile_x = oceanX - ix * _tileResolution;
-        float tile_y = oceanY - iy * _tileResolution;
+    float height;
+    getSurfaceHeightsAt(&x, &y, 1, &height, normal);
+    return height;
+}
 
-        if (normal != 0)
-        {
-            *normal = data.normalBiLinearInterp(tile_x, tile_y);
-        }
+void FFTOceanSurface::getSurfaceHeightsAt(const float* xs, const float* ys, size_t n, float* heights, osg::Vec3f* normals,
+                                          osg::Vec3f* velocities, osg::Vec3f* accelerations)
+{
+    if(_isDirty && (_mipmapData.empty() || !startRebuild()))
+        build();
 
-        return data.biLinearInterp(tile_x, tile_y);
-    }
+    const OceanTile& data = _mipmapData[_oldFrame][0];
+    const OceanTile& next = _mipmapData[ (_oldFrame+1) % _mipmapData.size() ][0];
 
-    return 0.0f;
+    sampleSurface( data, next, xs, ys, n, heights, normals, velocities, accelerations );
 }
 
 bool FFTOceanSurface::updateMipmaps( const osg::Vec3f& eye, unsigned int frame )
@@ -476,6 +600,8 @@ bool FFTOceanSurface::updateMipmaps( const osg::Vec3f& eye, unsigned int frame )
         _startPos.y() += (float)(y_offset * tileSize); 
     }
 
+    std::vector<unsigned int> levels( _numTiles*_numTiles, 0 );
+
     for( unsigned int y = 0; y < _numTiles; ++y)
     {
         for( unsigned int x = 0; x < _numTiles; ++x)
@@ -484,15 +610,24 @@ bool FFTOceanSurface::updateMipmaps( const osg::Vec3f& eye, unsigned int frame )
             newbound.x() += (float)(x_offset * tileSize);
             newbound.y() += (float)(y_offset * tileSize);
 
-            osg::Vec3f distanceToTile = newbound - eye;
-            
-            unsigned int mipmapLevel = 0;
+            const float distanceToTile2 = getLevelDistance2( newbound, eye );
 
+            // the coarsest level whose error stays under the pixel threshold
             for( unsigned int m = 0; m < _minDist.size(); ++m )
             {
-                if( distanceToTile.length2() > _minDist.at(m) )
-                    mipmapLevel = m;
+                if( distanceToTile2 > _minDist.at(m) )
+                    levels[y*_numTiles+x] = m;
             }
+        }
+    }
+
+    limitLevelSteps( levels );
+
+    for( unsigned int y = 0; y < _numTiles; ++y)
+    {
+        for( unsigned int x = 0; x < _numTiles; ++x)
+        {
+            const unsigned int mipmapLevel = levels[y*_numTiles+x];
 
             if( getTile(x,y)->getLevel() != mipmapLevel )
                 updated = true;
@@ -1033,6 +1168,14 @@ osg::Vec3f FFTOceanSurface::computeNoiseCoords(float noiseSize, const osg::Vec2f
     return osg::Vec3f( pos, tileScale );
 }
 
+osg::Vec3f FFTOceanSurface::computeJacobianCoords( void ) const
+{
+    // texel centres sit on the vertices of the tile lattice
+    return osg::Vec3f( _startPos.x() - _pointSpacing*0.5f, 
+                       _startPos.y() + _pointSpacing*0.5f, 
+                       _tileResInv );
+}
+
 #include <osgOcean/shaders/osgOcean_ocean_surface_vert.inl>
 #include <osgOcean/shaders/osgOcean_ocean_surface_frag.inl>
 
@@ -53,22 +53,9 @@ FFTOceanSurfaceVBO::FFTOceanSurfaceVBO( unsigned int FFTGridSize,
     ,_masterVertices ( new osg::Vec3Array )
     ,_masterNormals  ( new osg::Vec3Array )
 {
-    setUserData( new OceanDataType(*this, _NUMFRAMES, 25) );
+    setUserData( new OceanDataType(*this, _NUMFRAMES) );
     setCullCallback( new OceanAnimationCallback );
     setUpdateCallback( new OceanAnimationCallback );
-
-    _minDist.clear();
-    osg::notify(osg::INFO) << "Minimum Distances: " << std::endl;
-
-    for(unsigned int d = 0; d < _numLevels; ++d)
-    {
-        _minDist.push_back( d * (float(_tileResolution+1)) + ( float(_tileResolution+1.f)*0.5f ) );
-        _minDist.back() *= _minDist.back();
-        osg::notify(osg::INFO) << d << ": " << sqrt(_minDist.back()) << std::endl;
-    }
-
-    osg::notify(osg::INFO) << "FFTOceanSurfaceVBO::createOceanTiles() Complete." << std::endl;
-
 }
 
 FFTOceanSurfaceVBO::FFTOceanSurfaceVBO( const FFTOceanSurfaceVBO& copy, const osg::CopyOp& copyop )
@@ -81,23 +68,48 @@ FFTOceanSurfaceVBO::FFTOceanSurfaceVBO( const FFTOceanSurfaceVBO& copy, const os
 
 FFTOceanSurfaceVBO::~FFTOceanSurfaceVBO(void)
 {
+    // the live simulation writes to _mipmapData through computeFrame()
+    stopLiveSimulation();
 }
 
 void FFTOceanSurfaceVBO::build( void )
 {
     osg::notify(osg::INFO) << "FFTOceanSurfaceVBO::build()" << std::endl;
 
-    computeSea( _NUMFRAMES );
+    cancelRebuild();
+    computeSea( _isLive ? (unsigned int)LIVE_FRAMES : _NUMFRAMES );
+    buildGeometry(0);
+
+    _isDirty =  false;
+
+    osg::notify(osg::INFO) << "FFTOceanSurfaceVBO::build() Complete." << std::endl;
+}
+
+void FFTOceanSurfaceVBO::buildGeometry( unsigned int frame )
+{
     createOceanTiles();
     updateLevels(osg::Vec3f(0.0f, 0.0f, 0.0f));
-    updateVertices(0);
+    updateVertices(frame);
 
     initStateSet();
 
-    _isDirty =  false;
     _isStateDirty = false;
+}
 
-    osg::notify(osg::INFO) << "FFTOceanSurfaceVBO::build() Complete." << std::endl;
+void FFTOceanSurfaceVBO::swapFrames( FFTOceanTechnique& other )
+{
+    FFTOceanTechnique::swapFrames( other );
+
+    // other is a copy of this surface, see FFTOceanTechnique::startRebuild()
+    _mipmapData.swap( static_cast<FFTOceanSurfaceVBO&>(other)._mipmapData );
+}
+
+const OceanTile* FFTOceanSurfaceVBO::getSurfaceTile( unsigned int frame ) const
+{
+    if (_mipmapData.empty())
+        return NULL;
+
+    return &_mipmapData[ frame % _mipmapData.size() ];
 }
 
 void FFTOceanSurfaceVBO::initStateSet( void )
@@ -121,6 +133,12 @@ void FFTOceanSurfaceVBO::initStateSet( void )
     _stateset->addUniform( new osg::Uniform("osgOcean_FoamCapTop",      _foamCapTop ) );
     _stateset->addUniform( new osg::Uniform("osgOcean_FoamMap",         FOAM_MAP ) );
     _stateset->addUniform( new osg::Uniform("osgOcean_FoamScale",       _tileResInv*30.f ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_EnableJacobianFoam", _useJacobianFoam && _jacobianMaps.valid() ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_FoamJacobianBottom", _foamJacobianBottom ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_FoamJacobianTop",    _foamJacobianTop ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_JacobianMap",        JACOBIAN_MAP ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_JacobianFrame",      float(_oldFrame) ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_JacobianCoords",     computeJacobianCoords() ) );
 
     if( _useCrestFoam )
     {
@@ -130,6 +148,31 @@ void FFTOceanSurfaceVBO::initStateSet( void )
                                                    osg::StateAttribute::PROTECTED);
     }
 
+    if( _useCrestFoam && _useJacobianFoam && _jacobianMaps.valid() )
+    {
+        if (ShaderManager::instance().areShadersEnabled())
+            _stateset->setTextureAttributeAndModes( JACOBIAN_MAP, _jacobianMaps.get(), osg::StateAttribute::ON |
+                                                   osg::StateAttribute::PROTECTED );
+    }
+
+    // Detail cascades, tiled at their own lengths over the jacobian map coords
+    osg::Uniform* cascadeScales = new osg::Uniform( osg::Uniform::FLOAT, "osgOcean_CascadeScales", MAX_CASCADES );
+
+    for (unsigned int c = 0; c < getNumCascades(); ++c)
+        cascadeScales->setElement( c, (float)_tileResolution / getCascadeResolution(c) );
+
+    _stateset->addUniform( cascadeScales );
+    _stateset->addUniform( new osg::Uniform("osgOcean_CascadeMap",   CASCADE_MAP ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_NumCascades",  _cascadeMaps.valid() ? (int)getNumCascades() : 0 ) );
+    _stateset->addUniform( new osg::Uniform("osgOcean_CascadeLayer", float(_oldFrame*getNumCascades()) ) );
+
+    if( _cascadeMaps.valid() )
+    {
+        if (ShaderManager::instance().areShadersEnabled())
+            _stateset->setTextureAttributeAndModes( CASCADE_MAP, _cascadeMaps.get(), osg::StateAttribute::ON |
+                                                   osg::StateAttribute::PROTECTED );
+    }
+
     // Noise
     _stateset->addUniform( new osg::Uniform("osgOcean_NoiseMap",     NORMAL_MAP ) );
     _stateset->addUniform( new osg::Uniform("osgOcean_NoiseCoords0", computeNoiseCoords( 32.f, osg::Vec2f( 2.f, 4.f), 2.f, 0.f ) ) );
@@ -179,13 +222,15 @@ osg::ref_ptr<osg::Texture2D> FFTOceanSurfaceVBO::createNoiseMap(unsigned int siz
                                                              float waveScale,
                                                              float tileResolution )
 {
-    osg::ref_ptr<osg::FloatArray> heights = new osg::FloatArray;
+    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array;
 
-    FFTSimulation noiseFFT(size, windDir, windSpeed, _depth, _reflDampFactor, waveScale, tileResolution, 10.f);
+    // complemented seed so that the noise does not repeat the waves of the geometry
+    FFTSimulation noiseFFT(size, windDir, windSpeed, _depth, _reflDampFactor, waveScale, tileResolution, 10.f, NULL, ~_seed);
     noiseFFT.setTime(0.f);
-    noiseFFT.computeHeights(heights.get());
+    noiseFFT.computeTile(vertices.get(), 0.f, false, 0.f, normals.get());
         
-    OceanTile oceanTile(heights.get(),size,tileResolution/size);
+    OceanTile oceanTile(vertices.get(),normals.get(),size,tileResolution/size);
 
     return oceanTile.createNormalMap();
 }
@@ -196,44 +241,112 @@ void FFTOceanSurfaceVBO::computeSea( unsigned int totalFrames )
     osg::notify(osg::INFO) << "Mipmap Levels: " << _numLevels << std::endl;
     osg::notify(osg::INFO) << "Highest Resolution: " << _tileSize << std::endl;
 
-    FFTSimulation FFTSim( _tileSize, _windDirection, _windSpeed, _depth, _reflDampFactor, _waveScale, _tileResolution, _cycleTime );
-
     // clear previous mipmaps (if any)
+    stopLiveSimulation();
     _mipmapData.clear();
     _mipmapData.resize( totalFrames );
 
-    _averageHeight = 0.f;
-    _maxHeight = -FLT_MAX;
+    // the jacobian only varies where the surface is displaced
+    if (_isChoppy)
+        createJacobianMaps( totalFrames );
+    else
+        _jacobianMaps = NULL;
+
+    createSurfaceMotion( totalFrames );
+    createLevelErrors( totalFrames );
+
+    // only the first live frame is known up front, the others are being computed
+    unsigned int knownFrames = totalFrames;
 
-    for( unsigned int frame = 0; frame < totalFrames; ++frame )
+    std::vector<OceanTile> cachedTiles;
+
+    if (readFrameCache( totalFrames, 1, cachedTiles ))
+    {
+        _mipmapData.swap( cachedTiles );
+    }
+    else
     {
-        osg::ref_ptr<osg::FloatArray> heights = new osg::FloatArray;
-        osg::ref_ptr<osg::Vec2Array> displacements = NULL;
+        FFTSimulation FFTSim( _tileSize, _windDirection, _windSpeed, _depth, _reflDampFactor, _waveScale, _tileResolution, getSimulationLoopTime(), NULL, _seed );
 
-        if (_isChoppy)
-            displacements = new osg::Vec2Array;
+        if (_isLive)
+        {
+            startLiveSimulation( FFTSim );
+            knownFrames = 1;
+        }
+        else
+        {
+            bakeFrames( FFTSim, totalFrames );
+        }
 
-        float time = _cycleTime * ( float(frame) / float(totalFrames) );
+        if (!_isLive && !_frameCacheDirectory.empty())
+        {
+            std::vector<const OceanTile*> tiles;
 
-        FFTSim.setTime( time );
-        FFTSim.computeHeights( heights.get() );
+            for( unsigned int frame = 0; frame < totalFrames; ++frame )
+                tiles.push_back( &_mipmapData[frame] );
 
-        if(_isChoppy)
-            FFTSim.computeDisplacements( _choppyFactor, displacements.get() );
+            writeFrameCache( totalFrames, 1, tiles );
+        }
+    }
 
-        // Level 0
-        _mipmapData[frame] = OceanTile( heights.get(), _tileSize, _pointSpacing, displacements.get(), true );
+    // Summed in frame order so that the result does not depend on the threads
+    _averageHeight = 0.f;
+    _maxHeight = -FLT_MAX;
 
+    for( unsigned int frame = 0; frame < knownFrames; ++frame )
+    {
         _averageHeight += _mipmapData[frame].getAverageHeight();
 
         _maxHeight = osg::maximum(_maxHeight, _mipmapData[frame].getMaximumHeight());
     }
-    _averageHeight /= (float)totalFrames;
+
+    _averageHeight /= (float)knownFrames;
+
+    computeLevelErrors( knownFrames );
 
     osg::notify(osg::INFO) << "Average Height: " << _averageHeight << std::endl;
     osg::notify(osg::INFO) << "FFTOceanSurfaceVBO::computeSea() Complete." << std::endl;
 }
 
+void FFTOceanSurfaceVBO::computeFrame( FFTSimulation& sim, unsigned int frame, float time )
+{
+    osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+    osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array;
+    osg::ref_ptr<osg::FloatArray> jacobians = NULL;
+    osg::ref_ptr<osg::Vec3Array> velocities = NULL;
+    osg::ref_ptr<osg::Vec3Array> accelerations = NULL;
+
+    if (_isChoppy)
+        jacobians = new osg::FloatArray;
+
+    if (_computeMotion)
+    {
+        velocities = new osg::Vec3Array;
+        accelerations = new osg::Vec3Array;
+    }
+
+    sim.setTime( time );
+
+    // vertices, normals and jacobians are written straight from a single batched transform
+    sim.computeTile( vertices.get(), _pointSpacing, _isChoppy, _choppyFactor, normals.get(), jacobians.get(), velocities.get(), accelerations.get() );
+
+    if (jacobians.valid())
+        setJacobianMap( frame, jacobians.get() );
+
+    if (velocities.valid())
+        setSurfaceMotion( frame, velocities.get(), accelerations.get() );
+
+    // Level 0
+    _mipmapData[frame] = OceanTile( vertices.get(), normals.get(), _tileSize, _pointSpacing, true );
+
+    // the levels draw every 2^level-th vertex of level 0, see MipmapGeometryVBO
+    for(unsigned int level = 1; level < _numLevels; ++level )
+        setLevelError( frame, level, _mipmapData[frame].computeSubsampledDelta( 1u << level ) );
+
+    if (shouldPackFrames())
+        _mipmapData[frame].pack();
+}
+
 void FFTOceanSurfaceVBO::createOceanTiles( void )
 {
     osg::notify(osg::INFO) << "FFTOceanSurfaceVBO::createOceanTiles()" << std::endl;
@@ -315,6 +428,7 @@ void FFTOceanSurfaceVBO::setMinDistances( std::vector<float> &minDist )
         return;
     }
     _minDist.clear();
+    _fixedMinDist = true;
 
     osg::notify(osg::INFO) << "setting Minimum Distances: " << std::endl;
 
@@ -339,9 +453,30 @@ void FFTOceanSurfaceVBO::updateVertices(unsigned int frame)
 
     const OceanTile& data = _mipmapData[frame];
 
+    const float blend = getFrameBlend();
+
     // copy the new data into the master arrays
-    (*_masterVertices) = *data.getVertices();
-    (*_masterNormals)  = *data.getNormals();
+    if (blend > 0.f)
+    {
+        const OceanTile& next = _mipmapData[ (frame+1) % _mipmapData.size() ];
+
+        _masterVertices->resize( data.getNumVertices() );
+        _masterNormals->resize( data.getNumVertices() );
+
+        for(unsigned int i = 0; i < data.getNumVertices(); ++i )
+        {
+            osg::Vec3f normal = data.getNormal(i)*(1.f-blend) + next.getNormal(i)*blend;
+            normal.normalize();
+
+            (*_masterVertices)[i] = data.getVertex(i)*(1.f-blend) + next.getVertex(i)*blend;
+            (*_masterNormals) [i] = normal;
+        }
+    }
+    else
+    {
+        data.copyVertices( *_masterVertices );
+        data.copyNormals ( *_masterNormals );
+    }
 
     // dirty the arrays so VBOs are resent.
     _masterVertices->dirty();
@@ -459,51 +594,39 @@ bool FFTOceanSurfaceVBO::updateLevels(const osg::Vec3f& eye)
       }
    }
    
-   unsigned updates=0;
-   
-   for(int r = _numTiles-1; r>=0; --r )
+   std::vector<unsigned int> levels( _numTiles*_numTiles, 0 );
+
+   for(int r = 0; r < (int)_numTiles; ++r )
    {
-      for(int c = _numTiles-1; c>=0; --c )
+      for(int c = 0; c < (int)_numTiles; ++c )
       {
-         osgOcean::MipmapGeometryVBO* curGeom = _mipmapGeom.at(r).at(c).get();
-         osg::Vec3f centre = curGeom->getBound().center();
+         osg::Vec3f centre = _mipmapGeom.at(r).at(c)->getBound().center();
          
-         float distanceToTile2 = (centre-eye).length2();
-         
-         unsigned mipmapLevel = 0;
-         unsigned rightLevel  = 0;
-         unsigned belowLevel  = 0;
+         float distanceToTile2 = getLevelDistance2( centre, eye );
          
+         // the coarsest level whose error stays under the pixel threshold
          for( unsigned int m = 0; m < _minDist.size(); ++m )
          {
             if( distanceToTile2 > _minDist.at(m) )
-               mipmapLevel = m;
+               levels[r*_numTiles+c] = m;
          }
+      }
+   }
+
+   // the tile borders only stitch neighbours at most one level apart
+   limitLevelSteps( levels );
+
+   unsigned updates=0;
+   
+   for(int r = _numTiles-1; r>=0; --r )
+   {
+      for(int c = _numTiles-1; c>=0; --c )
+      {
+         osgOcean::MipmapGeometryVBO* curGeom = _mipmapGeom.at(r).at(c).get();
          
-         if( c != _numTiles-1 && r != _numTiles-1 ){
-            osgOcean::MipmapGeometryVBO* rightGeom = _mipmapGeom.at(r).at(c+1).get();
-            osgOcean::MipmapGeometryVBO* belowGeom = _mipmapGeom.at(r+1).at(c).get();
-            rightLevel = rightGeom->getLevel();
-            belowLevel = belowGeom->getLevel();
-         }
-         else 
-         {
-            if( c != _numTiles-1 ){
-               osgOcean::MipmapGeometryVBO* rightGeom = _mipmapGeom.at(r).at(c+1).get();
-               rightLevel = rightGeom->getLevel();
-            }
-            else{
-               rightLevel = mipmapLevel;
-            }
-            
-            if( r != _numTiles-1 ){
-               osgOcean::MipmapGeometryVBO* belowGeom = _mipmapGeom.at(r+1).at(c).get();
-               belowLevel = belowGeom->getLevel();
-            }
-            else{
-               belowLevel = mipmapLevel;
-            }
-         }
+         unsigned mipmapLevel = levels[r*_numTiles+c];
+         unsigned rightLevel  = c != _numTiles-1 ? levels[r*_numTiles+c+1]   : mipmapLevel;
+         unsigned belowLevel  = r != _numTiles-1 ? levels[(r+1)*_numTiles+c] : mipmapLevel;
 
          if( curGeom->updatePrimitives(mipmapLevel,rightLevel,belowLevel) )
             updates++;
@@ -537,11 +660,20 @@ void FFTOceanSurfaceVBO::update( unsigned int frame, const double& dt, const osg
     startTime = osg::Timer::instance()->tick();
 #endif /*OSTOCEAN_TIMING*/
 
-    if(_isDirty)
+    // a finished background rebuild is swapped in between frames
+    if(finishRebuild())
+        buildGeometry(frame);
+
+    // the current sea is shown until a background rebuild is done
+    if(_isDirty && (_mipmapData.empty() || !startRebuild()))
         build();
     else if(_isStateDirty)
         initStateSet();
 
+    // the live simulation keeps its own time, frame only counts the baked cycle
+    if (_isLive)
+        frame = getLiveFrame( dt );
+
     if (_isAnimating)
     {
         static double time = 0.0;
@@ -555,7 +687,13 @@ void FFTOceanSurfaceVBO::update( unsigned int frame, const double& dt, const osg
         getStateSet()->getUniform("osgOcean_NoiseCoords0")->set( computeNoiseCoords( 32.f, osg::Vec2f( 2.f, 4.f), 2.f, time ) );
         getStateSet()->getUniform("osgOcean_NoiseCoords1")->set( computeNoiseCoords( 8.f,  osg::Vec2f(-4.f, 2.f), 1.f, time ) );
 
-        if( updateLevels(eye) || frame != _oldFrame )
+        // live frames are swapped into the first layers of the maps
+        const unsigned int layer = _isLive ? 0 : frame;
+
+        getStateSet()->getUniform("osgOcean_JacobianFrame")->set( float(layer) );
+        getStateSet()->getUniform("osgOcean_CascadeLayer")->set( float(layer*getNumCascades()) );
+
+        if( updateLevels(eye) || frame != _oldFrame || getFrameBlend() > 0.f )
         {
             updateVertices(frame);
         } 
@@ -572,45 +710,21 @@ void FFTOceanSurfaceVBO::update( unsigned int frame, const double& dt, const osg
 
 float FFTOceanSurfaceVBO::getSurfaceHeightAt(float x, float y, osg::Vec3f* normal)
 {
-    if(_isDirty)
-        build();
-
-    // Initialize normal so it's in a "known" state if we can't calculate it later.
-    if (normal != 0)
-    {
-        normal->set(0, 0, 1);
-    }
-
-    // ocean surface coordinates
-    float oceanX, oceanY;
-
-    // translate x, y to oceanSurface origin coordinates
-    oceanX = -_startPos.x() + x;
-    oceanY =  _startPos.y() - y;
-
-    // calculate the corresponding tile on the ocean surface
-    unsigned int ix = oceanX/_tileResolution;
-    unsigned int iy = oceanY/_tileResolution;
-
-    unsigned int frame = _oldFrame;
-
-    // Test if the tile is valid 
-    if (ix < _numTiles && iy < _numTiles)
-    {
-        const OceanTile& data = _mipmapData[_oldFrame];
-
-        float tile_x = oceanX - ix * (int) _tileResolution;
-        float tile_y = oceanY - iy * (int) _tileResolution;
+    float height;
+    getSurfaceHeightsAt(&x, &y, 1, &height, normal);
+    return height;
+}
 
-        if (normal != 0)
-        {
-            *normal = data.normalBiLinearInterp(tile_x, tile_y);
-        }
+void FFTOceanSurfaceVBO::getSurfaceHeightsAt(const float* xs, const float* ys, size_t n, float* heights, osg::Vec3f* normals,
+                                             osg::Vec3f* velocities, osg::Vec3f* accelerations)
+{
+    if(_isDirty && (_mipmapData.empty() || !startRebuild()))
+        build();
 
-        return data.biLinearInterp(tile_x, tile_y);
-    }
+    const OceanTile& data = _mipmapData[_oldFrame];
+    const OceanTile& next = _mipmapData[ (_oldFrame+1) % _mipmapData.size() ];
 
-    return 0.0f;
+    sampleSurface( data, next, xs, ys, n, heights, normals, velocities, accelerations );
 }
 
 
@@ -626,6 +740,12 @@ osg::Vec3f FFTOceanSurfaceVBO::computeNoiseCoords(float noiseSize, const osg::Ve
     return osg::Vec3f( pos, tileScale );
 }
 
+osg::Vec3f FFTOceanSurfaceVBO::computeJacobianCoords( void ) const
+{
+    // gl_Vertex is tile local, texel centres sit on its vertices
+    return osg::Vec3f( -_pointSpacing*0.5f, _pointSpacing*0.5f, _tileResInv );
+}
+
 #include <osgOcean/shaders/osgOcean_ocean_surface_vbo_vert.inl>
 #include <osgOcean/shaders/osgOcean_ocean_surface_frag.inl>
 
@@ -17,120 +17,1460 @@
 
 #include <osgOcean/FFTOceanTechnique>
 #include <osgOcean/ShaderManager>
+#include <osgOcean/RandUtils>
 #include <osg/io_utils>
 #include <osg/Material>
 #include <osg/Timer>
+#include <osgDB/FileUtils>
+#include <osgDB/FileNameUtils>
+
+#include "MappedFile.h"
+#include "NormalMaps.h"
+#include "SurfaceKernels.h"
+
+#include <OpenThreads/Thread>
+#include <OpenThreads/Mutex>
+#include <OpenThreads/Condition>
+#include <OpenThreads/ScopedLock>
+
+#include <algorithm>
+#include <functional>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdio>
 
 using namespace osgOcean;
 
+namespace
+{
+    // Hands out the frames of FFTOceanTechnique::bakeFrames() one at a time, 
+    // so that threads which finish early pick up the remaining ones.
+    class FrameQueue
+    {
+    private:
+        OpenThreads::Mutex _mutex;
+        unsigned int _next;
+        unsigned int _totalFrames;
+
+    public:
+        FrameQueue( unsigned int totalFrames )
+            :_next        ( 0 )
+            ,_totalFrames ( totalFrames )
+        {}
+
+        bool pop( unsigned int& frame )
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+            if (_next >= _totalFrames)
+                return false;
+
+            frame = _next++;
+            return true;
+        }
+    };
+
+    // Layout of a frame cache file, in native byte order: the header, a tile 
+    // header and the packed data of every tile, frame by frame, then the 
+    // jacobian maps, the encoded cascade maps (see NormalMaps.h), the 
+    // velocities and accelerations and the mipmap level errors of every 
+    // frame. The parameters the frames were baked with are only recorded
+    // in the hash that names the file.
+    const char CACHE_MAGIC[8] = { 'o','s','g','O','c','e','a','n' };
+
+    // Bump whenever the layout or anything the baked frames depend on changes.
+    const unsigned int CACHE_VERSION = 4;
+
+    struct CacheHeader
+    {
+        char magic[8];
+        unsigned int version;
+        unsigned int numFrames;
+        unsigned int tilesPerFrame;
+        unsigned int mapSize;
+        unsigned int numJacobianMaps;   // per frame
+        unsigned int numCascadeMaps;    // per frame
+        unsigned int numMotionFields;   // per frame, (mapSize+1)^2 xyz floats each
+        unsigned int numLevelErrors;    // per frame, a float each
+    };
+
+    struct CacheTileHeader
+    {
+        unsigned int resolution;
+        unsigned int useVBO;
+        float spacing;
+        float packOffset[3];
+        float packScale[3];
+    };
+
+    // 64 bit FNV-1a hash of the parameters the baked frames depend on.
+    class CacheKey
+    {
+    private:
+        unsigned long long _hash;
+
+    public:
+        CacheKey( void )
+            :_hash ( 14695981039346656037ULL )
+        {}
+
+        void add( const void* data, size_t size )
+        {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+
+            for (size_t i = 0; i < size; ++i)
+            {
+                _hash ^= bytes[i];
+                _hash *= 1099511628211ULL;
+            }
+        }
+
+        template<typename T>
+        void add( const T& value )
+        {
+            add( &value, sizeof(T) );
+        }
+
+        unsigned long long get( void ) const
+        {
+            return _hash;
+        }
+    };
+
+    // Bounds checked reads from a mapped cache file.
+    class CacheReader
+    {
+    private:
+        const unsigned char* _data;
+        size_t _size;
+        size_t _pos;
+
+    public:
+        CacheReader( const unsigned char* data, size_t size )
+            :_data ( data )
+            ,_size ( size )
+            ,_pos  ( 0 )
+        {}
+
+        template<typename T>
+        bool read( T& value )
+        {
+            if (_size - _pos < sizeof(T))
+                return false;
+
+            memcpy( &value, _data+_pos, sizeof(T) );
+            _pos += sizeof(T);
+            return true;
+        }
+
+        /** @return the next size bytes, NULL if the file is too short. */
+        const unsigned char* skip( size_t size )
+        {
+            if (_size - _pos < size)
+                return NULL;
+
+            const unsigned char* data = _data+_pos;
+            _pos += size;
+            return data;
+        }
+
+        bool atEnd( void ) const
+        {
+            return _pos == _size;
+        }
+    };
+
+    /** Fastest surface query kernel for this CPU. */
+    Surface::SampleFunc getSampleKernel( void )
+    {
+#ifdef OSGOCEAN_AVX2
+        if (SIMD::cpuSupportsAVX2())
+            return &Surface::sampleAVX2;
+#endif
+#ifdef OSGOCEAN_SIMD_SSE2
+        return &Surface::sample<SIMD::SSEFloat>;
+#else
+        return &Surface::sample< SIMD::ScalarVec<float> >;
+#endif
+    }
+
+    /** First xyz of an array of vectors, NULL if there is none. */
+    inline const float* firstVector( const osg::Vec3Array* vectors )
+    {
+        return (vectors && !vectors->empty()) ? (*vectors)[0].ptr() : NULL;
+    }
+
+    /**
+    * Samples the level 0 tiles a and b, blended by blend, of a surface starting at 
+    * startPos. The tiles must be unpacked, their motion may be NULL.
+    */
+    void sampleTiles( const osg::Vec2f& startPos,
+                      unsigned int tileResolution,
+                      unsigned int numTiles,
+                      unsigned int iterations,
+                      float blend,
+                      const OceanTile& a,
+                      const OceanTile& b,
+                      const SurfaceMotion* motionA,
+                      const SurfaceMotion* motionB,
+                      const float* xs, 
+                      const float* ys, 
+                      size_t n, 
+                      float* heights, 
+                      osg::Vec3f* normals,
+                      osg::Vec3f* velocities,
+                      osg::Vec3f* accelerations )
+    {
+        Surface::Lattice lattice;
+        lattice.originX        = startPos.x();
+        lattice.originY        = startPos.y();
+        lattice.tileSize       = (float)tileResolution;
+        lattice.tileSizeInv    = 1.f / (float)tileResolution;
+        lattice.extent         = (float)(tileResolution*numTiles);
+        lattice.spacing        = a.getSpacing();
+        lattice.spacingInv     = 1.f / a.getSpacing();
+        lattice.resolution     = a.getResolution();
+        lattice.gridInVertices = a.getUseVBO();
+        lattice.iterations     = iterations;
+
+        Surface::Samples sa, sb;
+
+        sa.vertices = (*a.getVertices())[0].ptr();
+        sa.normals  = normals ? (*a.getNormals())[0].ptr() : NULL;
+        sa.velocities    = (velocities && motionA) ? firstVector( motionA->velocities.get() ) : NULL;
+        sa.accelerations = (accelerations && motionA) ? firstVector( motionA->accelerations.get() ) : NULL;
+
+        sb.vertices = blend > 0.f ? (*b.getVertices())[0].ptr() : NULL;
+        sb.normals  = (blend > 0.f && normals) ? (*b.getNormals())[0].ptr() : NULL;
+        sb.velocities    = (blend > 0.f && sa.velocities && motionB) ? firstVector( motionB->velocities.get() ) : NULL;
+        sb.accelerations = (blend > 0.f && sa.accelerations && motionB) ? firstVector( motionB->accelerations.get() ) : NULL;
+
+        // blend only where both frames have motion
+        if (blend > 0.f && !sb.velocities)    sa.velocities    = NULL;
+        if (blend > 0.f && !sb.accelerations) sa.accelerations = NULL;
+
+        Surface::Outputs out;
+        out.heights       = heights;
+        out.normals       = normals ? normals[0].ptr() : NULL;
+        out.velocities    = velocities ? velocities[0].ptr() : NULL;
+        out.accelerations = accelerations ? accelerations[0].ptr() : NULL;
+
+        getSampleKernel()( lattice, sa, sb, blend, xs, ys, (int)n, out );
+
+        if (normals && blend > 0.f)
+        {
+            for (size_t i = 0; i < n; ++i)
+                normals[i].normalize();
+        }
+    }
+}
+
+// --------------------------------------------------------
+//  SurfaceSnapshot implementation
+// --------------------------------------------------------
+
+SurfaceSnapshot::SurfaceSnapshot( unsigned int frame,
+                                  double time,
+                                  const osg::Vec2f& startPos,
+                                  unsigned int tileResolution,
+                                  unsigned int numTiles,
+                                  unsigned int iterations,
+                                  float blend,
+                                  const OceanTile& tile,
+                                  const OceanTile& nextTile,
+                                  const SurfaceMotion& motion,
+                                  const SurfaceMotion& nextMotion )
+    :_frame          ( frame )
+    ,_time           ( time )
+    ,_startPos       ( startPos )
+    ,_tileResolution ( tileResolution )
+    ,_numTiles       ( numTiles )
+    ,_iterations     ( iterations )
+    ,_blend          ( blend )
+    ,_tile           ( tile )
+    ,_nextTile       ( nextTile )
+    ,_motion         ( motion )
+    ,_nextMotion     ( nextMotion )
+{}
+
+float SurfaceSnapshot::getSurfaceHeightAt( float x, float y, osg::Vec3f* normal ) const
+{
+    float height;
+    getSurfaceHeightsAt(&x, &y, 1, &height, normal);
+    return height;
+}
+
+void SurfaceSnapshot::getSurfaceHeightsAt( const float* xs, const float* ys, size_t n, float* heights, osg::Vec3f* normals,
+                                           osg::Vec3f* velocities, osg::Vec3f* accelerations ) const
+{
+    sampleTiles( _startPos, _tileResolution, _numTiles, _iterations, _blend, _tile, _nextTile, &_motion, &_nextMotion, 
+                 xs, ys, n, heights, normals, velocities, accelerations );
+}
+
+// --------------------------------------------------------
+//  FFTOceanTechnique implementation
+// --------------------------------------------------------
+
+class FFTOceanTechnique::BakeThread : public OpenThreads::Thread
+{
+private:
+    FFTOceanTechnique& _technique;
+    FFTSimulation _sim;             /**< Own copy so that FFT plans and buffers are not shared. */
+    std::vector<FFTSimulation*> _cascades;  /**< Own copies of the detail cascades. */
+    FrameQueue& _queue;
+    unsigned int _totalFrames;
+
+public:
+    BakeThread( FFTOceanTechnique& technique, 
+                const FFTSimulation& sim, 
+                const std::vector<FFTSimulation*>& cascades,
+                FrameQueue& queue, 
+                unsigned int totalFrames )
+        :_technique   ( technique )
+        ,_sim         ( sim )
+        ,_queue       ( queue )
+        ,_totalFrames ( totalFrames )
+    {
+        for (unsigned int c = 0; c < cascades.size(); ++c)
+            _cascades.push_back( new FFTSimulation( *cascades[c] ) );
+    }
+
+    ~BakeThread( void )
+    {
+        for (unsigned int c = 0; c < _cascades.size(); ++c)
+            delete _cascades[c];
+    }
+
+    static void bake( FFTOceanTechnique& technique, 
+                      FFTSimulation& sim, 
+                      const std::vector<FFTSimulation*>& cascades,
+                      FrameQueue& queue, 
+                      unsigned int totalFrames )
+    {
+        unsigned int frame;
+
+        while (queue.pop(frame))
+        {
+            const float time = technique._cycleTime * ( float(frame) / float(totalFrames) );
+
+            technique.computeFrame( sim, frame, time );
+
+            for (unsigned int c = 0; c < cascades.size(); ++c)
+                technique.computeCascadeFrame( *cascades[c], c, frame, time );
+
+            ++technique._framesBaked;
+        }
+    }
+
+    virtual void run( void )
+    {
+        bake( _technique, _sim, _cascades, _queue, _totalFrames );
+    }
+};
+
+// Computes the frames of a live simulation into three slots: the one shown, 
+// the latest completed one and the one being computed. The update traversal 
+// swaps the shown slot for the completed one whenever a new frame is ready, 
+// and the thread moves on to the time the update traversal asked for last.
+class FFTOceanTechnique::LiveThread : public OpenThreads::Thread
+{
+private:
+    FFTOceanTechnique& _technique;
+    FFTSimulation _sim;
+    std::vector<FFTSimulation*> _cascades;   /**< Adopted, deleted with the thread. */
+
+    OpenThreads::Mutex _mutex;
+    OpenThreads::Condition _condition;
+
+    bool _done;
+    bool _hasNewFrame;          /**< _ready holds a frame that was not shown yet. */
+    unsigned int _displayed;
+    unsigned int _ready;
+    unsigned int _writing;
+    double _nextTime;           /**< Time of the next frame to compute (secs). */
+
+public:
+    LiveThread( FFTOceanTechnique& technique, 
+                const FFTSimulation& sim, 
+                const std::vector<FFTSimulation*>& cascades )
+        :_technique   ( technique )
+        ,_sim         ( sim )
+        ,_cascades    ( cascades )
+        ,_done        ( false )
+        ,_hasNewFrame ( false )
+        ,_displayed   ( 0 )
+        ,_ready       ( 1 )
+        ,_writing     ( 2 )
+        ,_nextTime    ( 0.0 )
+    {}
+
+    ~LiveThread( void )
+    {
+        for (unsigned int c = 0; c < _cascades.size(); ++c)
+            delete _cascades[c];
+    }
+
+    void stop( void )
+    {
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+            _done = true;
+        }
+
+        _condition.signal();
+        join();
+    }
+
+    /**
+    * Asks for the frame at time+dt to be computed next and returns the slot to
+    * show in frame. @return true if the slot changed since the last call.
+    */
+    bool pick( double time, double dt, unsigned int& frame )
+    {
+        bool isNew = false;
+
+        {
+            OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+            _nextTime = time + dt;
+
+            if (_hasNewFrame)
+            {
+                std::swap( _displayed, _ready );
+                _hasNewFrame = false;
+                isNew = true;
+            }
+
+            frame = _displayed;
+        }
+
+        if (isNew)
+            _condition.signal();
+
+        return isNew;
+    }
+
+    virtual void run( void )
+    {
+        const double loopTime = _technique.getSimulationLoopTime();
+
+        while (true)
+        {
+            unsigned int slot;
+            double time;
+
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+                while (!_done && _hasNewFrame)
+                    _condition.wait(&_mutex);
+
+                if (_done)
+                    return;
+
+                slot = _writing;
+                time = _nextTime;
+            }
+
+            const float loopedTime = (float)fmod( time, loopTime );
+
+            _technique.computeFrame( _sim, slot, loopedTime );
+
+            for (unsigned int c = 0; c < _cascades.size(); ++c)
+                _technique.computeCascadeFrame( *_cascades[c], c, slot, loopedTime );
+
+            {
+                OpenThreads::ScopedLock<OpenThreads::Mutex> lock(_mutex);
+
+                std::swap( _writing, _ready );
+                _hasNewFrame = true;
+            }
+        }
+    }
+};
+
+// Computes the sea of a copy of the technique, see startRebuild(). The copy is 
+// only touched by the thread until isDone() returned true.
+class FFTOceanTechnique::RebuildThread : public OpenThreads::Thread
+{
+private:
+    osg::ref_ptr<FFTOceanTechnique> _sea;
+    OpenThreads::Atomic _done;
+
+public:
+    RebuildThread( FFTOceanTechnique* sea )
+        :_sea  ( sea )
+        ,_done ( 0 )
+    {}
+
+    inline FFTOceanTechnique* getSea( void ) const{
+        return _sea.get();
+    }
+
+    inline bool isDone( void ) const{
+        return _done != 0;
+    }
+
+    virtual void run( void )
+    {
+        _sea->computeSea( _sea->_NUMFRAMES );
+        ++_done;
+    }
+};
+
+const float FFTOceanTechnique::LIVE_LOOP_TIME = 600.f;
+
+
+FFTOceanTechnique::FFTOceanTechnique( unsigned int FFTGridSize,
+                                      unsigned int resolution,
+                                      unsigned int numTiles, 
+                                      const osg::Vec2f& windDirection,
+                                      float windSpeed,
+                                      float depth,
+                                      float reflectionDamping,
+                                      float waveScale,
+                                      bool isChoppy,
+                                      float choppyFactor,
+                                      float animLoopTime,
+                                      unsigned int numFrames )
+    :_tileSize       ( FFTGridSize )
+    ,_noiseTileSize  ( FFTGridSize )
+    ,_tileResolution ( resolution )
+    ,_tileResInv     ( 1.f / float(resolution) )
+    ,_noiseTileRes   ( resolution )
+    ,_numTiles       ( numTiles )
+    ,_pointSpacing   ( _tileResolution / _tileSize )
+    ,_windDirection  ( windDirection )
+    ,_noiseWindDir   ( windDirection )
+    ,_windSpeed      ( windSpeed )
+    ,_noiseWindSpeed ( windSpeed )
+    ,_waveScale      ( waveScale )
+    ,_noiseWaveScale ( waveScale )
+    ,_depth          ( depth )
+    ,_reflDampFactor ( reflectionDamping )
+    ,_cycleTime      ( animLoopTime )
+    ,_seed           ( 0 )
+    ,_choppyFactor   ( choppyFactor )
+    ,_isChoppy       ( isChoppy )
+    ,_isEndless      ( false )
+    ,_oldFrame       ( 0 )
+    ,_fresnelMul     ( 0.7 )
+    ,_numLevels      ( (unsigned int) ( log( (float)_tileSize) / log(2.f) )+1)
+    ,_startPos       ( -float( (_tileResolution+1)*_numTiles) * 0.5f, float( (_tileResolution+1)*_numTiles) * 0.5f )
+    ,_THRESHOLD      ( 3.f )
+    ,_VRES           ( 1024 )
+    ,_A              ( 1.f / tan( osg::DegreesToRadians(15.f) ) )
+    ,_C              ( _A * _VRES / (2.f*_THRESHOLD) )
+    ,_NUMFRAMES      ( numFrames )
+    ,_numBakeThreads ( 0 )
+    ,_isLive         ( false )
+    ,_liveTime       ( 0.0 )
+    ,_packFrames     ( false )
+    ,_interpolateFrames( false )
+    ,_frameBlend     ( 0.f )
+    ,_asyncRebuild   ( false )
+    ,_framesBaked    ( 0 )
+    ,_queryIterations( 3 )
+    ,_computeMotion  ( false )
+    ,_publishSnapshots( false )
+    ,_waveTopColor   ( 0.192156862f, 0.32549019f, 0.36862745098f )
+    ,_waveBottomColor( 0.11372549019f, 0.219607843f, 0.3568627450f )
+    ,_useCrestFoam   ( false )
+    ,_foamCapBottom  ( 2.2f )
+    ,_foamCapTop     ( 3.0f )
+    ,_useJacobianFoam( true )
+    ,_foamJacobianBottom( 0.8f )
+    ,_foamJacobianTop( 0.2f )
+    ,_isStateDirty   ( true )
+    ,_averageHeight  ( 0.f )
+    ,_fixedMinDist   ( false )
+    ,_lightColor     ( 0.411764705f, 0.54117647f, 0.6823529f, 1.f )
+    ,_liveThread     ( NULL )
+    ,_rebuildThread  ( NULL )
+{
+    _stateset = new osg::StateSet;
+    addResourcePaths();
+    setUserData( new OceanDataType(*this, _NUMFRAMES) );
+    setOceanAnimationCallback( new OceanAnimationCallback );
+}
+
+FFTOceanTechnique::FFTOceanTechnique( const FFTOceanTechnique& copy, const osg::CopyOp& copyop ):
+    OceanTechnique   ( copy, copyop )
+    ,_tileSize       ( copy._tileSize )
+    ,_noiseTileSize  ( copy._noiseTileSize )
+    ,_tileResolution ( copy._tileResolution )
+    ,_tileResInv     ( copy._tileResInv )
+    ,_noiseTileRes   ( copy._noiseTileRes )
+    ,_numTiles       ( copy._numTiles )
+    ,_pointSpacing   ( copy._pointSpacing )
+    ,_windDirection  ( copy._windDirection )
+    ,_noiseWindDir   ( copy._noiseWindDir )
+    ,_windSpeed      ( copy._windSpeed )
+    ,_noiseWindSpeed ( copy._noiseWindSpeed )
+    ,_waveScale      ( copy._waveScale )
+    ,_noiseWaveScale ( copy._noiseWaveScale )
+    ,_depth          ( copy._depth )
+    ,_reflDampFactor ( copy._reflDampFactor )
+    ,_cycleTime      ( copy._cycleTime )
+    ,_seed           ( copy._seed )
+    ,_cascadeResolutions( copy._cascadeResolutions )
+    ,_choppyFactor   ( copy._choppyFactor )
+    ,_isChoppy       ( copy._isChoppy )
+    ,_isEndless      ( copy._isEndless )
+    ,_oldFrame       ( copy._oldFrame )
+    ,_fresnelMul     ( copy._fresnelMul )
+    ,_numLevels      ( copy._numLevels )
+    ,_startPos       ( copy._startPos )
+    ,_THRESHOLD      ( copy._THRESHOLD )
+    ,_VRES           ( copy._VRES )
+    ,_A              ( copy._A )
+    ,_C              ( copy._C )
+    ,_NUMFRAMES      ( copy._NUMFRAMES )
+    ,_numBakeThreads ( copy._numBakeThreads )
+    ,_isLive         ( copy._isLive )
+    ,_liveTime       ( copy._liveTime )
+    ,_packFrames     ( copy._packFrames )
+    ,_interpolateFrames( copy._interpolateFrames )
+    ,_frameBlend     ( copy._frameBlend )
+    ,_frameCacheDirectory( copy._frameCacheDirectory )
+    ,_frameCache     ( copy._frameCache )
+    ,_asyncRebuild   ( copy._asyncRebuild )
+    ,_framesBaked    ( 0 )
+    ,_queryIterations( copy._queryIterations )
+    ,_computeMotion  ( copy._computeMotion )
+    ,_publishSnapshots( copy._publishSnapshots )
+    ,_minDist        ( copy._minDist )
+    ,_fixedMinDist   ( copy._fixedMinDist )
+    ,_frameLevelErrors( copy._frameLevelErrors )
+    ,_levelErrors    ( copy._levelErrors )
+    ,_environmentMap ( copy._environmentMap )
+    ,_waveTopColor   ( copy._waveTopColor )
+    ,_waveBottomColor( copy._waveBottomColor )
+    ,_useCrestFoam   ( copy._useCrestFoam )
+    ,_foamCapBottom  ( copy._foamCapBottom )
+    ,_foamCapTop     ( copy._foamCapTop )
+    ,_useJacobianFoam( copy._useJacobianFoam )
+    ,_foamJacobianBottom( copy._foamJacobianBottom )
+    ,_foamJacobianTop( copy._foamJacobianTop )
+    ,_jacobianMaps   ( copy._jacobianMaps )
+    ,_cascadeMaps    ( copy._cascadeMaps )
+    ,_jacobianImages ( copy._jacobianImages )
+    ,_cascadeImages  ( copy._cascadeImages )
+    ,_surfaceMotion  ( copy._surfaceMotion )
+    ,_isStateDirty   ( copy._isStateDirty )
+    ,_averageHeight  ( copy._averageHeight )
+    ,_maxHeight      ( copy._maxHeight )
+    ,_lightColor     ( copy._lightColor )
+    ,_liveThread     ( NULL )
+    ,_rebuildThread  ( NULL )
+{}
+
+FFTOceanTechnique::~FFTOceanTechnique(void)
+{
+    stopLiveSimulation();
+    cancelRebuild();
+}
+
+osg::Texture2D* FFTOceanTechnique::createTexture(const std::string& name, osg::Texture::WrapMode wrap)
+{
+    osg::Texture2D* tex = new osg::Texture2D();
+
+    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
+    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
+    tex->setWrap  (osg::Texture::WRAP_S,     wrap);
+    tex->setWrap  (osg::Texture::WRAP_T,     wrap);
+    tex->setImage (osgDB::readImageFile(name.c_str()));
+
+    return tex;
+}
+
+void FFTOceanTechnique::createJacobianMaps( unsigned int numFrames )
+{
+    const unsigned int numLayers = _isLive ? 1 : numFrames;
+
+    _jacobianMaps = new osg::Texture2DArray;
+
+    _jacobianMaps->setTextureSize( _tileSize, _tileSize, numLayers );
+    _jacobianMaps->setInternalFormat( GL_LUMINANCE );
+    _jacobianMaps->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR );
+    _jacobianMaps->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    _jacobianMaps->setWrap  ( osg::Texture::WRAP_S,     osg::Texture::REPEAT );
+    _jacobianMaps->setWrap  ( osg::Texture::WRAP_T,     osg::Texture::REPEAT );
+
+    // live frames are swapped in by the update traversal
+    if (_isLive)
+        _jacobianMaps->setDataVariance( osg::Object::DYNAMIC );
+
+    _jacobianImages.resize( numFrames );
+
+    // Allocated up front so that the frames can be filled in concurrently.
+    for (unsigned int frame = 0; frame < numFrames; ++frame)
+    {
+        osg::Image* img = new osg::Image;
+        img->allocateImage( _tileSize, _tileSize, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE, 1 );
+        img->setInternalTextureFormat( GL_LUMINANCE );
+
+        _jacobianImages[frame] = img;
+    }
+
+    for (unsigned int layer = 0; layer < numLayers; ++layer)
+        _jacobianMaps->setImage( layer, _jacobianImages[layer].get() );
+}
+
+void FFTOceanTechnique::setJacobianMap( unsigned int frame, const osg::FloatArray* jacobians )
+{
+    const unsigned int size = _tileSize*_tileSize;
+
+    osg::Image* img = _jacobianImages[frame].get();
+    unsigned char* pixels = img->data();
+
+    for (unsigned int i = 0; i < size; ++i)
+    {
+        pixels[i] = (unsigned char)( osg::clampBetween( (*jacobians)[i] * 0.5f, 0.f, 1.f ) * 255.f + 0.5f );
+    }
+
+    img->dirty();
+}
+
+void FFTOceanTechnique::createSurfaceMotion( unsigned int numFrames )
+{
+    if (_computeMotion)
+        _surfaceMotion.assign( numFrames, SurfaceMotion() );
+    else
+        _surfaceMotion.clear();
+}
+
+void FFTOceanTechnique::setSurfaceMotion( unsigned int frame, osg::Vec3Array* velocities, osg::Vec3Array* accelerations )
+{
+    SurfaceMotion& motion = _surfaceMotion[frame];
+
+    motion.velocities    = velocities;
+    motion.accelerations = accelerations;
+}
+
+const SurfaceMotion* FFTOceanTechnique::getSurfaceMotion( unsigned int frame ) const
+{
+    if (_surfaceMotion.empty())
+        return NULL;
+
+    return &_surfaceMotion[ frame % _surfaceMotion.size() ];
+}
+
+void FFTOceanTechnique::createLevelErrors( unsigned int numFrames )
+{
+    _frameLevelErrors.assign( numFrames*_numLevels, 0.f );
+}
+
+void FFTOceanTechnique::computeLevelErrors( unsigned int numFrames )
+{
+    _levelErrors.assign( _numLevels, 0.f );
+
+    for (unsigned int frame = 0; frame < numFrames; ++frame)
+    {
+        for (unsigned int level = 0; level < _numLevels; ++level)
+            _levelErrors[level] = osg::maximum( _levelErrors[level], _frameLevelErrors[frame*_numLevels + level] );
+    }
+
+    computeMinDistances();
+}
+
+void FFTOceanTechnique::computeMinDistances( void )
+{
+    if (_fixedMinDist || _levelErrors.size() != _numLevels)
+        return;
+
+    // A vertical error delta seen from distance d spans delta*A/d of the [-1,1] 
+    // clip range, i.e. delta*A*_VRES/(2d) pixels, which is below _THRESHOLD 
+    // from d = delta*C on.
+    const float T = (2.f * _THRESHOLD) / _VRES;
+
+    _C = _A / T;
+
+    _minDist.resize( _numLevels );
+
+    osg::notify(osg::INFO) << "Minimum Distances: " << std::endl;
+
+    float minDist = 0.f;
+
+    for (unsigned int level = 0; level < _numLevels; ++level)
+    {
+        // coarser levels are never used closer than finer ones
+        minDist = osg::maximum( minDist, _levelErrors[level] * _C );
+
+        _minDist[level] = minDist * minDist;
+
+        osg::notify(osg::INFO) << level << ": " << minDist << " (" << _levelErrors[level] << "m)" << std::endl;
+    }
+}
+
+void FFTOceanTechnique::setMaxPixelError( float pixels )
+{
+    _THRESHOLD = osg::maximum( pixels, 0.01f );
+
+    computeMinDistances();
+}
+
+void FFTOceanTechnique::setLODProjection( float cotHalfFovy, float viewportHeight )
+{
+    if (cotHalfFovy <= 0.f || viewportHeight <= 0.f)
+        return;
+
+    if (cotHalfFovy == _A && viewportHeight == _VRES)
+        return;
+
+    _A    = cotHalfFovy;
+    _VRES = viewportHeight;
+
+    computeMinDistances();
+}
+
+float FFTOceanTechnique::getLevelDistance2( const osg::Vec3f& centre, const osg::Vec3f& eye ) const
+{
+    const osg::Vec3f toTile = centre - eye;
+    const float distance2 = toTile.length2();
+
+    if (_fixedMinDist)
+        return distance2;
+
+    const float horizontal = osg::Vec2f( toTile.x(), toTile.y() ).length() + (float)_tileResolution * 0.70710678f;
+    const float horizontal2 = horizontal * horizontal;
+
+    // d / cos = d * d / horizontal
+    if (horizontal2 >= distance2)
+        return distance2;
+
+    return distance2 * distance2 / horizontal2;
+}
+
+void FFTOceanTechnique::limitLevelSteps( std::vector<unsigned int>& levels ) const
+{
+    const int n = (int)_numTiles;
+
+    // Each level becomes the minimum over all tiles of their level plus their 
+    // distance in tiles, swept from the top left and then from the bottom right.
+    for (int y = 0; y < n; ++y)
+    {
+        for (int x = 0; x < n; ++x)
+        {
+            unsigned int& level = levels[y*n + x];
+
+            if (x > 0) level = osg::minimum( level, levels[y*n + x-1] + 1 );
+            if (y > 0) level = osg::minimum( level, levels[(y-1)*n + x] + 1 );
+        }
+    }
+
+    for (int y = n-1; y >= 0; --y)
+    {
+        for (int x = n-1; x >= 0; --x)
+        {
+            unsigned int& level = levels[y*n + x];
+
+            if (x < n-1) level = osg::minimum( level, levels[y*n + x+1] + 1 );
+            if (y < n-1) level = osg::minimum( level, levels[(y+1)*n + x] + 1 );
+        }
+    }
+}
+
+void FFTOceanTechnique::addCascade( float tileResolution )
+{
+    if (_cascadeResolutions.size() >= (unsigned int)MAX_CASCADES)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::addCascade() at most " << MAX_CASCADES << " cascades are supported." << std::endl;
+        return;
+    }
+
+    if (tileResolution <= 0.f || tileResolution >= (float)_tileResolution)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::addCascade() cascades must be shorter than the surface tile." << std::endl;
+        return;
+    }
+
+    _cascadeResolutions.push_back( tileResolution );
+    std::sort( _cascadeResolutions.begin(), _cascadeResolutions.end(), std::greater<float>() );
+
+    _isDirty = true;
+}
+
+void FFTOceanTechnique::createCascadeMaps( unsigned int numFrames )
+{
+    const unsigned int numMaps   = numFrames * _cascadeResolutions.size();
+    const unsigned int numLayers = _isLive ? _cascadeResolutions.size() : numMaps;
+
+    _cascadeMaps = new osg::Texture2DArray;
+
+    _cascadeMaps->setTextureSize( _tileSize, _tileSize, numLayers );
+    _cascadeMaps->setInternalFormat( NormalMaps::FORMAT );
+    _cascadeMaps->setFilter( osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR );
+    _cascadeMaps->setFilter( osg::Texture::MAG_FILTER, osg::Texture::LINEAR );
+    _cascadeMaps->setWrap  ( osg::Texture::WRAP_S,     osg::Texture::REPEAT );
+    _cascadeMaps->setWrap  ( osg::Texture::WRAP_T,     osg::Texture::REPEAT );
+
+    // live frames are swapped in by the update traversal
+    if (_isLive)
+        _cascadeMaps->setDataVariance( osg::Object::DYNAMIC );
+
+    _cascadeImages.resize( numMaps );
+
+    for (unsigned int map = 0; map < numMaps; ++map)
+        _cascadeImages[map] = NormalMaps::createImage( _tileSize );
+
+    for (unsigned int layer = 0; layer < numLayers; ++layer)
+        _cascadeMaps->setImage( layer, _cascadeImages[layer].get() );
+}
+
+float FFTOceanTechnique::getCascadeBoundary( unsigned int level ) const
+{
+    const float length = level == 0 ? (float)_tileResolution : _cascadeResolutions[level-1];
+
+    return osg::PI * (float)_tileSize / length;
+}
+
+void FFTOceanTechnique::computeCascadeFrame( FFTSimulation& sim, unsigned int cascade, unsigned int frame, float time )
+{
+    osg::ref_ptr<osg::Vec3Array> normals = new osg::Vec3Array;
+
+    sim.setTime( time );
+    sim.computeFields( NULL, NULL, 0.f, NULL, normals.get() );
+
+    osg::Image* img = _cascadeImages[ frame*_cascadeResolutions.size() + cascade ].get();
+
+    NormalMaps::encode( &normals->front(), _tileSize, _tileSize, img->data() );
+
+    img->dirty();
+}
+
+void FFTOceanTechnique::createCascades( FFTSimulation& sim, unsigned int numFrames, std::vector<FFTSimulation*>& cascades )
+{
+    // Each cascade takes the waves from the boundary of the level above to its 
+    // own, the shortest one everything beyond. Same grid, same loop time, a 
+    // wave scale that keeps the energy per unit of wave number of the surface,
+    // and a seed of its own so the cascades do not repeat each other.
+    if (!_cascadeResolutions.empty())
+    {
+        sim.setWaveNumberRange( 0.f, getCascadeBoundary(0) );
+
+        createCascadeMaps( numFrames );
+
+        for (unsigned int c = 0; c < _cascadeResolutions.size(); ++c)
+        {
+            const float length = _cascadeResolutions[c];
+            const float scale  = (float)_tileResolution / length;
+
+            FFTSimulation* cascade = new FFTSimulation( _tileSize, _windDirection, _windSpeed, _depth, _reflDampFactor, 
+                                                        _waveScale*scale*scale, length, getSimulationLoopTime(), NULL, 
+                                                        (unsigned int)RandUtils::counterRand( _seed, c+1 ) );
+
+            const bool last = ( c+1 == _cascadeResolutions.size() );
+
+            cascade->setWaveNumberRange( getCascadeBoundary(c), last ? FLT_MAX : getCascadeBoundary(c+1) );
+
+            cascades.push_back( cascade );
+        }
+    }
+    else
+    {
+        _cascadeMaps = NULL;
+        _cascadeImages.clear();
+    }
+}
+
+void FFTOceanTechnique::bakeFrames( FFTSimulation& sim, unsigned int totalFrames )
+{
+    std::vector<FFTSimulation*> cascades;
+
+    createCascades( sim, totalFrames, cascades );
+
+    unsigned int numThreads = _numBakeThreads;
+
+    if (numThreads == 0)
+        numThreads = OpenThreads::GetNumberOfProcessors();
+
+    numThreads = osg::clampBetween( numThreads, 1u, osg::maximum(totalFrames, 1u) );
+
+    osg::notify(osg::INFO) << "FFTOceanTechnique::bakeFrames() using " << numThreads << " threads." << std::endl;
+
+    FrameQueue queue( totalFrames );
+
+    // The copies are made up front, creating their plans is serialised anyway.
+    std::vector<BakeThread*> threads;
+
+    for (unsigned int t = 1; t < numThreads; ++t)
+    {
+        BakeThread* thread = new BakeThread( *this, sim, cascades, queue, totalFrames );
+
+        if (thread->start() == 0)
+            threads.push_back( thread );
+        else
+            delete thread;
+    }
+
+    BakeThread::bake( *this, sim, cascades, queue, totalFrames );
+
+    for (unsigned int t = 0; t < threads.size(); ++t)
+    {
+        threads[t]->join();
+        delete threads[t];
+    }
+
+    for (unsigned int c = 0; c < cascades.size(); ++c)
+        delete cascades[c];
+
+    // every thread planned its own transforms, only one of each needs to stay around
+    const std::vector<std::string> backends = FFTBackend::getBackendNames();
+
+    for (unsigned int b = 0; b < backends.size(); ++b)
+    {
+        FFTBackend* backend = FFTBackend::getBackend( backends[b] );
+
+        if (backend)
+            backend->releaseUnusedPlans();
+    }
+}
+
+void FFTOceanTechnique::startLiveSimulation( FFTSimulation& sim )
+{
+    stopLiveSimulation();
+
+    std::vector<FFTSimulation*> cascades;
+
+    createCascades( sim, LIVE_FRAMES, cascades );
+
+    // The first frame is shown straight away, the thread takes it from there.
+    _liveTime = 0.0;
+
+    computeFrame( sim, 0, 0.f );
+
+    for (unsigned int c = 0; c < cascades.size(); ++c)
+        computeCascadeFrame( *cascades[c], c, 0, 0.f );
+
+    _liveThread = new LiveThread( *this, sim, cascades );
+
+    if (_liveThread->start() != 0)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::startLiveSimulation() could not start the simulation thread." << std::endl;
+
+        delete _liveThread;
+        _liveThread = NULL;
+    }
+
+    showLiveFrame( 0 );
+    _oldFrame = 0;
+}
+
+void FFTOceanTechnique::stopLiveSimulation( void )
+{
+    if (_liveThread)
+    {
+        _liveThread->stop();
+
+        delete _liveThread;
+        _liveThread = NULL;
+    }
+}
+
+unsigned int FFTOceanTechnique::getLiveFrame( double dt )
+{
+    if (!_liveThread)
+        return _oldFrame;
+
+    _liveTime += dt * 0.001;
+
+    unsigned int frame;
+
+    if (_liveThread->pick( _liveTime, dt * 0.001, frame ))
+        showLiveFrame( frame );
+
+    return frame;
+}
+
+bool FFTOceanTechnique::startRebuild( void )
+{
+    if (!_asyncRebuild || _isLive)
+        return false;
+
+    // another rebuild follows this one, as the sea stays dirty
+    if (_rebuildThread)
+        return true;
+
+    osg::ref_ptr<osg::Object> copy = clone( osg::CopyOp::SHALLOW_COPY );
+
+    FFTOceanTechnique* sea = dynamic_cast<FFTOceanTechnique*>( copy.get() );
+
+    if (!sea)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::startRebuild() " << className() << " cannot be rebuilt in the background." << std::endl;
+        return false;
+    }
+
+    // the copy shares the drawables and state of this one, which are in use by the scene graph
+    sea->removeDrawables( 0, sea->getNumDrawables() );
+    sea->setStateSet( NULL );
+
+    _rebuildThread = new RebuildThread( sea );
+
+    if (_rebuildThread->start() != 0)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::startRebuild() could not start the rebuild thread." << std::endl;
+
+        delete _rebuildThread;
+        _rebuildThread = NULL;
+        return false;
+    }
+
+    osg::notify(osg::INFO) << "FFTOceanTechnique::startRebuild() Started." << std::endl;
+
+    _isDirty = false;
+    return true;
+}
+
+bool FFTOceanTechnique::finishRebuild( void )
+{
+    if (!_rebuildThread || !_rebuildThread->isDone())
+        return false;
+
+    _rebuildThread->join();
+
+    osg::ref_ptr<FFTOceanTechnique> sea = _rebuildThread->getSea();
+
+    delete _rebuildThread;
+    _rebuildThread = NULL;
+
+    // switched to the live simulation in the meantime, which is built in place
+    if (_isLive)
+        return false;
+
+    swapFrames( *sea );
 
-FFTOceanTechnique::FFTOceanTechnique( unsigned int FFTGridSize,
-                                      unsigned int resolution,
-                                      unsigned int numTiles, 
-                                      const osg::Vec2f& windDirection,
-                                      float windSpeed,
-                                      float depth,
-                                      float reflectionDamping,
-                                      float waveScale,
-                                      bool isChoppy,
-                                      float choppyFactor,
-                                      float animLoopTime,
-                                      unsigned int numFrames )
-    :_tileSize       ( FFTGridSize )
-    ,_noiseTileSize  ( FFTGridSize )
-    ,_tileResolution ( resolution )
-    ,_tileResInv     ( 1.f / float(resolution) )
-    ,_noiseTileRes   ( resolution )
-    ,_numTiles       ( numTiles )
-    ,_pointSpacing   ( _tileResolution / _tileSize )
-    ,_windDirection  ( windDirection )
-    ,_noiseWindDir   ( windDirection )
-    ,_windSpeed      ( windSpeed )
-    ,_noiseWindSpeed ( windSpeed )
-    ,_waveScale      ( waveScale )
-    ,_noiseWaveScale ( waveScale )
-    ,_depth          ( depth )
-    ,_reflDampFactor ( reflectionDamping )
-    ,_cycleTime      ( animLoopTime )
-    ,_choppyFactor   ( choppyFactor )
-    ,_isChoppy       ( isChoppy )
-    ,_isEndless      ( false )
-    ,_oldFrame       ( 0 )
-    ,_fresnelMul     ( 0.7 )
-    ,_numLevels      ( (unsigned int) ( log( (float)_tileSize) / log(2.f) )+1)
-    ,_startPos       ( -float( (_tileResolution+1)*_numTiles) * 0.5f, float( (_tileResolution+1)*_numTiles) * 0.5f )
-    ,_THRESHOLD      ( 3.f )
-    ,_VRES           ( 1024 )
-    ,_NUMFRAMES      ( numFrames )
-    ,_waveTopColor   ( 0.192156862f, 0.32549019f, 0.36862745098f )
-    ,_waveBottomColor( 0.11372549019f, 0.219607843f, 0.3568627450f )
-    ,_useCrestFoam   ( false )
-    ,_foamCapBottom  ( 2.2f )
-    ,_foamCapTop     ( 3.0f )
-    ,_isStateDirty   ( true )
-    ,_averageHeight  ( 0.f )
-    ,_lightColor     ( 0.411764705f, 0.54117647f, 0.6823529f, 1.f )
+    osg::notify(osg::INFO) << "FFTOceanTechnique::finishRebuild() Complete." << std::endl;
+
+    // the previous frames are released along with the copy
+    return true;
+}
+
+void FFTOceanTechnique::cancelRebuild( void )
 {
-    _stateset = new osg::StateSet;
-    addResourcePaths();
-    setUserData( new OceanDataType(*this, _NUMFRAMES, 25) );
-    setOceanAnimationCallback( new OceanAnimationCallback );
+    if (_rebuildThread)
+    {
+        _rebuildThread->join();
+
+        delete _rebuildThread;
+        _rebuildThread = NULL;
+    }
 }
 
-FFTOceanTechnique::FFTOceanTechnique( const FFTOceanTechnique& copy, const osg::CopyOp& copyop ):
-    OceanTechnique   ( copy, copyop )
-    ,_tileSize       ( copy._tileSize )
-    ,_noiseTileSize  ( copy._noiseTileSize )
-    ,_tileResolution ( copy._tileResolution )
-    ,_tileResInv     ( copy._tileResInv )
-    ,_noiseTileRes   ( copy._noiseTileRes )
-    ,_numTiles       ( copy._numTiles )
-    ,_pointSpacing   ( copy._pointSpacing )
-    ,_windDirection  ( copy._windDirection )
-    ,_noiseWindDir   ( copy._noiseWindDir )
-    ,_windSpeed      ( copy._windSpeed )
-    ,_noiseWindSpeed ( copy._noiseWindSpeed )
-    ,_waveScale      ( copy._waveScale )
-    ,_noiseWaveScale ( copy._noiseWaveScale )
-    ,_depth          ( copy._depth )
-    ,_cycleTime      ( copy._cycleTime )
-    ,_choppyFactor   ( copy._choppyFactor )
-    ,_isChoppy       ( copy._isChoppy )
-    ,_isEndless      ( copy._isEndless )
-    ,_oldFrame       ( copy._oldFrame )
-    ,_fresnelMul     ( copy._fresnelMul )
-    ,_numLevels      ( copy._numLevels )
-    ,_startPos       ( copy._startPos )
-    ,_THRESHOLD      ( copy._THRESHOLD )
-    ,_VRES           ( copy._VRES )
-    ,_NUMFRAMES      ( copy._NUMFRAMES )
-    ,_minDist        ( copy._minDist )
-    ,_environmentMap ( copy._environmentMap )
-    ,_waveTopColor   ( copy._waveTopColor )
-    ,_waveBottomColor( copy._waveBottomColor )
-    ,_useCrestFoam   ( copy._useCrestFoam )
-    ,_foamCapBottom  ( copy._foamCapBottom )
-    ,_foamCapTop     ( copy._foamCapTop )
-    ,_isStateDirty   ( copy._isStateDirty )
-    ,_averageHeight  ( copy._averageHeight )
-    ,_lightColor     ( copy._lightColor )
-{}
+void FFTOceanTechnique::swapFrames( FFTOceanTechnique& other )
+{
+    std::swap( _jacobianMaps, other._jacobianMaps );
+    std::swap( _cascadeMaps,  other._cascadeMaps );
 
-FFTOceanTechnique::~FFTOceanTechnique(void)
+    _jacobianImages.swap( other._jacobianImages );
+    _cascadeImages.swap( other._cascadeImages );
+    _surfaceMotion.swap( other._surfaceMotion );
+    _frameLevelErrors.swap( other._frameLevelErrors );
+    _levelErrors.swap( other._levelErrors );
+
+    std::swap( _averageHeight, other._averageHeight );
+    std::swap( _maxHeight,     other._maxHeight );
+    std::swap( _frameCache,    other._frameCache );
+
+    // the distances of this surface follow its own projection
+    computeMinDistances();
+}
+
+float FFTOceanTechnique::getRebuildProgress( void ) const
 {
+    if (!_rebuildThread)
+        return 1.f;
+
+    const unsigned int framesBaked = _rebuildThread->getSea()->_framesBaked;
+
+    return osg::minimum( float(framesBaked) / float(_NUMFRAMES), 1.f );
 }
 
-osg::Texture2D* FFTOceanTechnique::createTexture(const std::string& name, osg::Texture::WrapMode wrap)
+std::string FFTOceanTechnique::getFrameCachePath( unsigned int numFrames, unsigned int tilesPerFrame ) const
 {
-    osg::Texture2D* tex = new osg::Texture2D();
+    CacheKey key;
 
-    tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::LINEAR_MIPMAP_LINEAR);
-    tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::LINEAR);
-    tex->setWrap  (osg::Texture::WRAP_S,     wrap);
-    tex->setWrap  (osg::Texture::WRAP_T,     wrap);
-    tex->setImage (osgDB::readImageFile(name.c_str()));
+    const char* surface = className();
 
-    return tex;
+    key.add( CACHE_VERSION );
+    key.add( surface, strlen(surface) );
+    key.add( numFrames );
+    key.add( tilesPerFrame );
+    key.add( _tileSize );
+    key.add( _tileResolution );
+    key.add( _pointSpacing );
+    key.add( _windDirection.x() );
+    key.add( _windDirection.y() );
+    key.add( _windSpeed );
+    key.add( _depth );
+    key.add( _reflDampFactor );
+    key.add( _waveScale );
+    key.add( _isChoppy );
+    key.add( _choppyFactor );
+    key.add( _cycleTime );
+    key.add( _seed );
+    key.add( _computeMotion );
+
+    for (unsigned int c = 0; c < _cascadeResolutions.size(); ++c)
+        key.add( _cascadeResolutions[c] );
+
+    std::ostringstream name;
+    name << "osgOcean_" << std::hex << std::setw(16) << std::setfill('0') << key.get() << ".cache";
+
+    return osgDB::concatPaths( _frameCacheDirectory, name.str() );
+}
+
+bool FFTOceanTechnique::readFrameCache( unsigned int numFrames, unsigned int tilesPerFrame, std::vector<OceanTile>& tiles )
+{
+    _frameCache = NULL;
+
+    if (_frameCacheDirectory.empty() || _isLive)
+        return false;
+
+    const std::string path = getFrameCachePath( numFrames, tilesPerFrame );
+
+    osg::ref_ptr<MappedFile> file = MappedFile::open( path );
+
+    if (!file.valid())
+        return false;
+
+    CacheReader reader( file->data(), file->size() );
+    CacheHeader header;
+
+    const unsigned int numJacobianMaps = _jacobianMaps.valid() ? 1 : 0;
+    const unsigned int numCascadeMaps  = _cascadeResolutions.size();
+    const unsigned int numMotionFields = _surfaceMotion.empty() ? 0 : 2;
+
+    if (!reader.read(header)
+        || memcmp( header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC) ) != 0
+        || header.version != CACHE_VERSION
+        || header.numFrames != numFrames
+        || header.tilesPerFrame != tilesPerFrame
+        || header.mapSize != _tileSize
+        || header.numJacobianMaps != numJacobianMaps
+        || header.numCascadeMaps != numCascadeMaps
+        || header.numMotionFields != numMotionFields
+        || header.numLevelErrors != _numLevels)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::readFrameCache() " << path << " does not match, rebaking." << std::endl;
+        return false;
+    }
+
+    std::vector<OceanTile> cached;
+    cached.reserve( numFrames*tilesPerFrame );
+
+    for (unsigned int t = 0; t < numFrames*tilesPerFrame; ++t)
+    {
+        CacheTileHeader tile;
+
+        if (!reader.read(tile) || tile.resolution > _tileSize)
+            break;
+
+        const unsigned int rowLength = tile.resolution + 1;
+        const unsigned char* data = reader.skip( rowLength*rowLength*8 );
+
+        if (!data)
+            break;
+
+        cached.push_back( OceanTile( data, file.get(), tile.resolution, tile.spacing, tile.useVBO != 0,
+                                     osg::Vec3f( tile.packOffset[0], tile.packOffset[1], tile.packOffset[2] ),
+                                     osg::Vec3f( tile.packScale[0],  tile.packScale[1],  tile.packScale[2] ) ) );
+    }
+
+    const size_t mapBytes = _tileSize*_tileSize;
+    const size_t cascadeBytes = NormalMaps::getEncodedSize( _tileSize );
+    const size_t numMotionVectors = (_tileSize+1)*(_tileSize+1);
+
+    const unsigned char* jacobians = reader.skip( numFrames*numJacobianMaps*mapBytes );
+    const unsigned char* cascades  = reader.skip( numFrames*numCascadeMaps*cascadeBytes );
+    const unsigned char* motion    = reader.skip( numFrames*numMotionFields*numMotionVectors*sizeof(osg::Vec3f) );
+    const unsigned char* errors    = reader.skip( numFrames*_numLevels*sizeof(float) );
+
+    if (cached.size() != numFrames*tilesPerFrame || !jacobians || !cascades || !motion || !errors || !reader.atEnd())
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::readFrameCache() " << path << " is truncated, rebaking." << std::endl;
+        return false;
+    }
+
+    // The images view the file as well, it stays mapped as long as the frames are in use.
+    // The mapping is copy on write (see MappedFile.h), writing to the images only copies
+    // the pages written to instead of faulting.
+    if (numJacobianMaps)
+    {
+        for (unsigned int frame = 0; frame < numFrames; ++frame)
+        {
+            unsigned char* pixels = const_cast<unsigned char*>( jacobians + frame*mapBytes );
+
+            _jacobianImages[frame]->setImage( _tileSize, _tileSize, 1, GL_LUMINANCE, GL_LUMINANCE, GL_UNSIGNED_BYTE, 
+                                              pixels, osg::Image::NO_DELETE, 1 );
+        }
+    }
+
+    if (numCascadeMaps)
+    {
+        createCascadeMaps( numFrames );
+
+        for (unsigned int map = 0; map < numFrames*numCascadeMaps; ++map)
+        {
+            unsigned char* pixels = const_cast<unsigned char*>( cascades + map*cascadeBytes );
+
+            NormalMaps::setImage( _cascadeImages[map].get(), _tileSize, pixels, osg::Image::NO_DELETE );
+        }
+    }
+    else
+    {
+        _cascadeMaps = NULL;
+        _cascadeImages.clear();
+    }
+
+    // Copied, the queries and snapshots hold on to the arrays of a frame.
+    for (unsigned int frame = 0; frame < numFrames && numMotionFields; ++frame)
+    {
+        const osg::Vec3f* velocities    = reinterpret_cast<const osg::Vec3f*>( motion ) + (2*frame  )*numMotionVectors;
+        const osg::Vec3f* accelerations = reinterpret_cast<const osg::Vec3f*>( motion ) + (2*frame+1)*numMotionVectors;
+
+        _surfaceMotion[frame].velocities    = new osg::Vec3Array( velocities, velocities+numMotionVectors );
+        _surfaceMotion[frame].accelerations = new osg::Vec3Array( accelerations, accelerations+numMotionVectors );
+    }
+
+    const float* levelErrors = reinterpret_cast<const float*>( errors );
+
+    _frameLevelErrors.assign( levelErrors, levelErrors + numFrames*_numLevels );
+
+    tiles.swap( cached );
+    _frameCache = file.get();
+
+    osg::notify(osg::INFO) << "FFTOceanTechnique::readFrameCache() mapped " << path << std::endl;
+
+    return true;
+}
+
+void FFTOceanTechnique::writeFrameCache( unsigned int numFrames, unsigned int tilesPerFrame, const std::vector<const OceanTile*>& tiles ) const
+{
+    if (_frameCacheDirectory.empty() || _isLive)
+        return;
+
+    if (!osgDB::makeDirectory( _frameCacheDirectory ))
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::writeFrameCache() cannot create " << _frameCacheDirectory << std::endl;
+        return;
+    }
+
+    const std::string path = getFrameCachePath( numFrames, tilesPerFrame );
+
+    // Written under a temporary name so that other processes never map a partial file.
+    const std::string tempPath = path + ".tmp";
+
+    std::ofstream out( tempPath.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+
+    CacheHeader header;
+    memcpy( header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC) );
+    header.version         = CACHE_VERSION;
+    header.numFrames       = numFrames;
+    header.tilesPerFrame   = tilesPerFrame;
+    header.mapSize         = _tileSize;
+    header.numJacobianMaps = _jacobianMaps.valid() ? 1 : 0;
+    header.numCascadeMaps  = _cascadeMaps.valid() ? _cascadeResolutions.size() : 0;
+    header.numMotionFields = _surfaceMotion.empty() ? 0 : 2;
+    header.numLevelErrors  = _numLevels;
+
+    out.write( reinterpret_cast<const char*>(&header), sizeof(header) );
+
+    for (unsigned int t = 0; t < tiles.size(); ++t)
+    {
+        const OceanTile& tile = *tiles[t];
+
+        if (!tile.isPacked())
+        {
+            out.setstate( std::ios::failbit );
+            break;
+        }
+
+        CacheTileHeader tileHeader;
+        tileHeader.resolution = tile.getResolution();
+        tileHeader.useVBO     = tile.getUseVBO() ? 1 : 0;
+        tileHeader.spacing    = tile.getSpacing();
+
+        for (unsigned int c = 0; c < 3; ++c)
+        {
+            tileHeader.packOffset[c] = tile.getPackOffset()[c];
+            tileHeader.packScale[c]  = tile.getPackScale()[c];
+        }
+
+        out.write( reinterpret_cast<const char*>(&tileHeader), sizeof(tileHeader) );
+        out.write( reinterpret_cast<const char*>(tile.getPackedData()), tile.getPackedSize() );
+    }
+
+    const size_t mapBytes = _tileSize*_tileSize;
+
+    for (unsigned int frame = 0; frame < numFrames*header.numJacobianMaps; ++frame)
+        out.write( reinterpret_cast<const char*>(_jacobianImages[frame]->data()), mapBytes );
+
+    for (unsigned int map = 0; map < numFrames*header.numCascadeMaps; ++map)
+        out.write( reinterpret_cast<const char*>(_cascadeImages[map]->data()), NormalMaps::getEncodedSize(_tileSize) );
+
+    const unsigned int numMotionVectors = (_tileSize+1)*(_tileSize+1);
+
+    for (unsigned int frame = 0; frame < numFrames && header.numMotionFields; ++frame)
+    {
+        const SurfaceMotion& motion = _surfaceMotion[frame];
+
+        if (!motion.velocities.valid() || motion.velocities->size() != numMotionVectors 
+            || !motion.accelerations.valid() || motion.accelerations->size() != numMotionVectors)
+        {
+            out.setstate( std::ios::failbit );
+            break;
+        }
+
+        out.write( reinterpret_cast<const char*>(&(*motion.velocities)[0]),    numMotionVectors*sizeof(osg::Vec3f) );
+        out.write( reinterpret_cast<const char*>(&(*motion.accelerations)[0]), numMotionVectors*sizeof(osg::Vec3f) );
+    }
+
+    if (_frameLevelErrors.size() == numFrames*_numLevels)
+        out.write( reinterpret_cast<const char*>(&_frameLevelErrors[0]), _frameLevelErrors.size()*sizeof(float) );
+    else
+        out.setstate( std::ios::failbit );
+
+    out.close();
+
+    if (out.fail())
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::writeFrameCache() failed to write " << path << std::endl;
+        remove( tempPath.c_str() );
+        return;
+    }
+
+    // rename() replaces the old file atomically on POSIX, only Windows refuses to
+    // rename onto an existing file
+#if defined(_WIN32)
+    remove( path.c_str() );
+#endif
+
+    if (rename( tempPath.c_str(), path.c_str() ) != 0)
+    {
+        osg::notify(osg::WARN) << "FFTOceanTechnique::writeFrameCache() failed to write " << path << std::endl;
+        remove( tempPath.c_str() );
+        return;
+    }
+
+    osg::notify(osg::INFO) << "FFTOceanTechnique::writeFrameCache() wrote " << path << std::endl;
+}
+
+void FFTOceanTechnique::showLiveFrame( unsigned int frame )
+{
+    if (_jacobianMaps.valid())
+        _jacobianMaps->setImage( 0, _jacobianImages[frame].get() );
+
+    if (_cascadeMaps.valid())
+    {
+        const unsigned int numCascades = _cascadeResolutions.size();
+
+        for (unsigned int c = 0; c < numCascades; ++c)
+            _cascadeMaps->setImage( c, _cascadeImages[frame*numCascades+c].get() );
+    }
 }
 
 float FFTOceanTechnique::getSurfaceHeightAt(float x, float y, osg::Vec3f* normal)
@@ -139,6 +1479,107 @@ float FFTOceanTechnique::getSurfaceHeightAt(float x, float y, osg::Vec3f* normal
     return 0.f;
 }
 
+void FFTOceanTechnique::sampleSurface( const OceanTile& data, 
+                                       const OceanTile& next,
+                                       const float* xs, 
+                                       const float* ys, 
+                                       size_t n, 
+                                       float* heights, 
+                                       osg::Vec3f* normals,
+                                       osg::Vec3f* velocities,
+                                       osg::Vec3f* accelerations )
+{
+    const float blend = getFrameBlend();
+
+    const OceanTile& a = getQueryTile( data, 0 );
+    const OceanTile& b = blend > 0.f ? getQueryTile( next, 1 ) : a;
+
+    sampleTiles( _startPos, _tileResolution, _numTiles, _isChoppy ? _queryIterations : 0, blend, a, b, 
+                 getSurfaceMotion( _oldFrame ), getSurfaceMotion( _oldFrame+1 ),
+                 xs, ys, n, heights, normals, velocities, accelerations );
+}
+
+const OceanTile& FFTOceanTechnique::getQueryTile( const OceanTile& tile, unsigned int slot )
+{
+    if (!tile.isPacked())
+        return tile;
+
+    QueryTile& query = _queryTiles[slot];
+
+    if (query.packed.getPackedData() != tile.getPackedData())
+    {
+        osg::ref_ptr<osg::Vec3Array> vertices = new osg::Vec3Array;
+        osg::ref_ptr<osg::Vec3Array> normals  = new osg::Vec3Array;
+
+        tile.copyVertices( *vertices );
+        tile.copyNormals( *normals );
+
+        query.packed   = tile;
+        query.unpacked = OceanTile( vertices.get(), normals.get(), tile.getResolution(), tile.getSpacing(), tile.getUseVBO() );
+    }
+
+    return query.unpacked;
+}
+
+osg::ref_ptr<const SurfaceSnapshot> FFTOceanTechnique::getSurfaceSnapshot( void ) const
+{
+    // publishSnapshot() only releases replaced snapshots while no reader is 
+    // between loading the pointer and taking its reference.
+    ++_snapshotReaders;
+    osg::ref_ptr<const SurfaceSnapshot> snapshot = static_cast<const SurfaceSnapshot*>( _snapshot.get() );
+    --_snapshotReaders;
+
+    return snapshot;
+}
+
+void FFTOceanTechnique::publishSnapshot( void )
+{
+    osg::ref_ptr<SurfaceSnapshot> snapshot;
+
+    const OceanTile* tile = _publishSnapshots ? getSurfaceTile( _oldFrame ) : NULL;
+
+    if (tile)
+    {
+        const float blend = getFrameBlend();
+
+        // the snapshot shares the vertex arrays, as they are never modified once computed
+        const OceanTile& a = getQueryTile( *tile, 0 );
+        const OceanTile& b = blend > 0.f ? getQueryTile( *getSurfaceTile( _oldFrame+1 ), 1 ) : a;
+
+        const double time = _isLive 
+            ? fmod( _liveTime, (double)getSimulationLoopTime() ) 
+            : ( double(_oldFrame) + blend ) * _cycleTime / _NUMFRAMES;
+
+        const SurfaceMotion* motion     = getSurfaceMotion( _oldFrame );
+        const SurfaceMotion* nextMotion = getSurfaceMotion( _oldFrame+1 );
+
+        snapshot = new SurfaceSnapshot( _oldFrame, 
+                                        time, 
+                                        _startPos, 
+                                        _tileResolution, 
+                                        _numTiles, 
+                                        _isChoppy ? _queryIterations : 0, 
+                                        blend, 
+                                        a, 
+                                        b,
+                                        motion ? *motion : SurfaceMotion(),
+                                        nextMotion ? *nextMotion : SurfaceMotion() );
+    }
+
+    if (snapshot == _publishedSnapshot)
+        return;
+
+    _snapshot.assign( snapshot.get(), _publishedSnapshot.get() );
+
+    if (_publishedSnapshot.valid())
+        _retiredSnapshots.push_back( _publishedSnapshot );
+
+    _publishedSnapshot = snapshot;
+
+    if (_snapshotReaders == 0)
+        _retiredSnapshots.clear();
+}
+
 void FFTOceanTechnique::setOceanAnimationCallback(FFTOceanTechnique::OceanAnimationCallback* callback)
 {
     setUpdateCallback(callback);
@@ -155,13 +1596,13 @@ FFTOceanTechnique::OceanAnimationCallback* FFTOceanTechnique::getOceanAnimationC
 // --------------------------------------------------------
 
 FFTOceanTechnique::OceanDataType::OceanDataType( FFTOceanTechnique& ocean, 
-                                                 unsigned int numFrames, 
-                                                 unsigned int fps )
+                                                 unsigned int numFrames )
     :_oceanSurface  ( ocean )
     ,_NUMFRAMES     ( numFrames )
+    ,_cotHalfFovy   ( 0.f )
+    ,_viewportHeight( 0.f )
     ,_time          ( 0.0 )
-    ,_FPS           ( fps )
-    ,_msPerFrame    ( 1000.0/(double)fps )
+    ,_msPerFrame    ( ocean.getFramePeriod() )
     ,_frame         ( 0 )
     ,_oldTime       ( 0 )
     ,_newTime       ( 0 )
@@ -171,8 +1612,9 @@ FFTOceanTechnique::OceanDataType::OceanDataType( const OceanDataType& copy, cons
     :_oceanSurface  ( copy._oceanSurface )
     ,_NUMFRAMES     ( copy._NUMFRAMES )
     ,_eye           ( copy._eye )
+    ,_cotHalfFovy   ( copy._cotHalfFovy )
+    ,_viewportHeight( copy._viewportHeight )
     ,_time          ( copy._time )
-    ,_FPS           ( copy._FPS )
     ,_msPerFrame    ( copy._msPerFrame )
     ,_frame         ( copy._frame )
     ,_oldTime       ( copy._oldTime )
@@ -196,17 +1638,23 @@ void FFTOceanTechnique::OceanDataType::updateOcean( double simulationTime )
     double dt = osg::Timer::instance()->delta_m(_oldTime, _newTime);
     _time += dt;
 
+    // frames follow the simulation time, however many of them the cycle was baked into
+    _msPerFrame = _oceanSurface.getFramePeriod();
+
     if( _time >= _msPerFrame )
     {
-        _frame += ( _time / _msPerFrame );
+        const double framesElapsed = floor( _time / _msPerFrame );
 
-        if( _frame >= _NUMFRAMES ) 
-            _frame = _frame%_NUMFRAMES; 
+        _frame = ( _frame + (unsigned int)fmod( framesElapsed, (double)_NUMFRAMES ) ) % _NUMFRAMES;
 
         _time = fmod( _time, (double)_msPerFrame );
     }
 
+    _oceanSurface._frameBlend = float( _time / _msPerFrame );
+
+    _oceanSurface.setLODProjection( _cotHalfFovy, _viewportHeight );
     _oceanSurface.update( _frame, dt, _eye );
+    _oceanSurface.publishSnapshot();
 }
 
 // --------------------------------------------------------
@@ -363,6 +1811,11 @@ void FFTOceanTechnique::OceanAnimationCallback::update(osg::Node* node, osg::Nod
             else
             {
                 oceanData->setEye( cv->getEyePoint() );
+
+                const osg::Viewport* viewport = cv->getViewport();
+
+                if (viewport && cv->getProjectionMatrix())
+                    oceanData->setProjection( (*cv->getProjectionMatrix())(1,1), viewport->height() );
             }
         }
         else if( nv->getVisitorType() == osg::NodeVisitor::UPDATE_VISITOR ){
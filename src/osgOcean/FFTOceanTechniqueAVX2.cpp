@@ -0,0 +1,24 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+#include "SurfaceKernels.h"
+
+void osgOcean::Surface::sampleAVX2( const Lattice& lattice, const Samples& a, const Samples& b, float blend,
+                                    const float* xs, const float* ys, int count, const Outputs& out )
+{
+    sample<SIMD::AVXFloat>( lattice, a, b, blend, xs, ys, count, out );
+}
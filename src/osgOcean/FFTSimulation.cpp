@@ -16,59 +16,101 @@
 */
 #include <osgOcean/FFTSimulation>
 #include <osgOcean/RandUtils>
+#include "SpectrumKernels.h"
 
+#include <osg/Notify>
+#include <osg/Math>
+#include <osg/Vec2d>
+
+#include <algorithm>
 #include <complex>
 #include <vector>
 
 using namespace osgOcean;
 
-// The FFTW and FFTSS docs advise to use fftw_malloc and fftw_free instead
-// of new and delete for their data, as they claim to make special guarantees
-// of data alignment that the default new cannot do. In practice, they do not 
-// seem to make a significant difference in performance, but I guess we'd
-// better err on the side of caution and follow their recommendations.
-#define USE_FFTW_MALLOC
-
-// Sanity check - one and only one of the 3 USE_ flags should be defined.
-#if (defined(USE_FFTW3) && defined(USE_FFTW3F)) || \
-    (defined(USE_FFTW3) && defined(USE_FFTSS))  || \
-    (defined(USE_FFTW3F) && defined(USE_FFTSS)) || \
-    (!defined(USE_FFTW3) && !defined(USE_FFTW3F) && !defined(USE_FFTSS))
-#error Must use one of FFTW3 (double-precision), FFTW3F (single-precision) or FFTSS!
+namespace
+{
+    /** Wave vectors in the precision of the simulation. */
+    template<typename T> struct WaveVector;
+    template<> struct WaveVector<float>  { typedef osg::Vec2f type; };
+    template<> struct WaveVector<double> { typedef osg::Vec2d type; };
+
+    /** Fastest single precision spectrum kernel for this CPU. */
+    Spectrum::Evolve<float>::Func getEvolveKernel( float )
+    {
+#ifdef OSGOCEAN_AVX2
+        if (SIMD::cpuSupportsAVX2())
+            return &Spectrum::evolveAVX2;
 #endif
+#ifdef OSGOCEAN_SIMD_SSE2
+        return &Spectrum::evolve<SIMD::SSEFloat>;
+#else
+        return &Spectrum::evolve< SIMD::ScalarVec<float> >;
+#endif
+    }
 
-#if defined(USE_FFTW3) || defined(USE_FFTW3F)
+    /** Fastest double precision spectrum kernel for this CPU. */
+    Spectrum::Evolve<double>::Func getEvolveKernel( double )
+    {
+#ifdef OSGOCEAN_AVX2
+        if (SIMD::cpuSupportsAVX2())
+            return &Spectrum::evolveAVX2;
+#endif
+#ifdef OSGOCEAN_SIMD_SSE2
+        return &Spectrum::evolve<SIMD::SSEDouble>;
+#else
+        return &Spectrum::evolve< SIMD::ScalarVec<double> >;
+#endif
+    }
+}
 
-  #include <fftw3.h>
+// Interface between FFTSimulation and the Core of its precision.
+class FFTSimulation::Implementation
+{
+public:
+    virtual ~Implementation( void ){}
 
-  #if defined(USE_FFTW3)              // double precision
-    typedef double fftw_data_type;
-  #else //if defined(USE_FFTW3F)      // single precision
-    typedef float fftw_data_type;
+    /** Copy with the same spectrum and time but its own FFT plan. */
+    virtual Implementation* clone( void ) const = 0;
 
-    // alias the functions so that we can use the same function calls in both
-    // the double- and single-precision FFTW paths.
-    #define fftw_complex         fftwf_complex
-    #define fftw_plan            fftwf_plan
-    #define fftw_destroy_plan    fftwf_destroy_plan
-    #define fftw_plan_dft_2d     fftwf_plan_dft_2d
-    #define fftw_execute         fftwf_execute
-    #define fftw_malloc          fftwf_malloc
-    #define fftw_free            fftwf_free
-  #endif
+    virtual Precision getPrecision( void ) const = 0;
 
-#elif defined(USE_FFTSS)
+    virtual void setTime( float time ) = 0;
 
-  #include <fftw3compat.h>
-  typedef double fftw_data_type;      // FFTSS is double-precision only
+    virtual void setWaveNumberRange( float minK, float maxK ) = 0;
 
-#endif
+    virtual void computeHeights( osg::FloatArray* heights ) const = 0;
 
-typedef std::complex<fftw_data_type> complex;
+    virtual void computeDisplacements( const float& scaleFactor, osg::Vec2Array* waveDisplacements ) const = 0;
 
-class FFTSimulation::Implementation
+    virtual void computeFields( osg::FloatArray* heights, 
+                                osg::Vec2Array* waveDisplacements, 
+                                const float& scaleFactor, 
+                                osg::Vec2Array* slopes,
+                                osg::Vec3Array* normals,
+                                osg::FloatArray* jacobians,
+                                osg::Vec3Array* velocities,
+                                osg::Vec3Array* accelerations ) const = 0;
+
+    virtual void computeTile( osg::Vec3Array* vertices, 
+                              float spacing, 
+                              bool displace, 
+                              const float& scaleFactor, 
+                              osg::Vec3Array* normals,
+                              osg::FloatArray* jacobians,
+                              osg::Vec3Array* velocities,
+                              osg::Vec3Array* accelerations ) const = 0;
+};
+
+// The simulation in one precision: the spectrum is evolved and transformed in
+// T, only the fields handed back are converted to single precision.
+template<typename T>
+class FFTSimulation::Core : public FFTSimulation::Implementation
 {
 private:
+    typedef std::complex<T> complex;
+    typedef typename WaveVector<T>::type vec2;
+
     const double _PI2;             /**< 2*PI */
     const double _GRAVITY;         /**< Gravitational constant 9.81 */
     const double _GRAVITY2;        /**< Gravitational constant squared */
@@ -76,31 +118,67 @@ private:
     int _N;                        /**< Size of FFT grid 2^n ie 128,64,32 etc. */
     int _numPoints;                /**< Size of FFT squared */
     int _nOver2;                   /**< Half fourier size (_N/2)*/
-    osg::Vec2f _windDir;           /**< Direction of wind. */
-    float _windSpeed4;             /**< Wind speed (m/s) to power 4 */
-    float _A;                      /**< Wave scale modifier. */
-    float _length;                 /**< Real world tile resolution (m). */
-    float _w0;                     /**< Base frequency (2PI / looptime). */
-    float _maxWave;                /**< Maximum wave size for current wind speed */
-    float _depth;                  /**< Depth (m) */
-    float _reflDampFactor;         /**< Dampen reflections going against the wind */
-
-    fftw_complex *_complexData0;   /**< 2D complex data array used for FFT input*/
-    fftw_complex *_complexData1;   /**< 2D complex data array used for FFT input */
-
-    fftw_complex *_realData0;      /**< 2D complex data array used for FFT output */
-    fftw_complex *_realData1;      /**< 2D complex data array used for FFT output  */
-
-    fftw_plan _fftPlan0;           /**< 2D Inverse FFT plan */
-    fftw_plan _fftPlan1;           /**< 2D Inverse FFT plan */
+    int _spectrumWidth;            /**< Row length of the stored half spectrum (_N/2+1) */
+    int _numSpectrum;              /**< Number of stored fourier amplitudes (_N*_spectrumWidth) */
+    vec2 _windDir;                 /**< Direction of wind. */
+    T _windSpeed4;                 /**< Wind speed (m/s) to power 4 */
+    T _A;                          /**< Wave scale modifier. */
+    T _length;                     /**< Real world tile resolution (m). */
+    T _w0;                         /**< Base frequency (2PI / looptime). */
+    T _loopTime;                   /**< Time for animation to repeat (secs). */
+    T _maxWave;                    /**< Maximum wave size for current wind speed */
+    T _depth;                      /**< Depth (m) */
+    T _reflDampFactor;             /**< Dampen reflections going against the wind */
+    T _minK;                       /**< Waves with shorter wave numbers are dropped */
+    T _maxK;                       /**< Waves with this or longer wave numbers are dropped */
+
+    /** Real fields that can be computed from the current amplitudes, in the order the kernels expect. */
+    enum Field
+    {
+        HEIGHT         = Spectrum::HEIGHT,
+        DISPLACEMENT_X = Spectrum::DISPLACEMENT_X,
+        DISPLACEMENT_Y = Spectrum::DISPLACEMENT_Y,
+        SLOPE_X        = Spectrum::SLOPE_X,
+        SLOPE_Y        = Spectrum::SLOPE_Y,
+        DISPLACEMENT_XX = Spectrum::DISPLACEMENT_XX,
+        DISPLACEMENT_YY = Spectrum::DISPLACEMENT_YY,
+        DISPLACEMENT_XY = Spectrum::DISPLACEMENT_XY,
+        VELOCITY_Z     = Spectrum::VELOCITY_Z,
+        VELOCITY_X     = Spectrum::VELOCITY_X,
+        VELOCITY_Y     = Spectrum::VELOCITY_Y,
+        ACCELERATION_Z = Spectrum::ACCELERATION_Z,
+        ACCELERATION_X = Spectrum::ACCELERATION_X,
+        ACCELERATION_Y = Spectrum::ACCELERATION_Y,
+        MAX_FIELDS     = Spectrum::NUM_OUTPUTS,
+        MAX_SURFACE_FIELDS = Spectrum::VELOCITY_Z   /**< Fields of the surface itself, without its motion */
+    };
+
+    // The plan starts out with room for the surface fields only and grows
+    // to MAX_FIELDS the first time velocities or accelerations are requested.
+    mutable osg::ref_ptr<FFTBackend> _backend;             /**< FFT implementation */
+    mutable osg::ref_ptr< FFTPlan<T> > _fftPlan;           /**< Batched 2D inverse FFT of up to MAX_FIELDS fields */
 
     std::vector< complex > _baseAmplitudes; /**< Base fourier amplitudes */
-    std::vector< complex > _curAmplitudes;  /**< Current fourier amplitudes */  
 
-    std::vector< complex > _h0TildeK;
-    std::vector< complex > _h0TildeKconj;
-    std::vector< float > _wK;
-    std::vector< osg::Vec2 > _Kh;
+    // Time independent terms of the spectrum, one array per component,
+    // see Spectrum::Coefficients.
+    std::vector< T > _reCos;
+    std::vector< T > _reSin;
+    std::vector< T > _imCos;
+    std::vector< T > _imSin;
+    std::vector< T > _wK;                  /**< Angular frequencies, multiples of _w0 */
+    std::vector< int > _multiple;          /**< _wK / _w0 */
+    std::vector< T > _KhX;                 /**< Normalised wave vectors, used for displacements */
+    std::vector< T > _KhY;
+    std::vector< T > _KX;                  /**< Wave vectors, used for slopes */
+    std::vector< T > _KY;
+
+    Spectrum::Coefficients<T> _coeffs;     /**< Pointers into the arrays above */
+    typename Spectrum::Evolve<T>::Func _evolve;  /**< Fastest kernel for this CPU */
+
+    std::vector< T > _phaseCos;            /**< cos(m*_w0*t) for every multiple m in use, empty if not tabulated */
+    std::vector< T > _phaseSin;            /**< sin(m*_w0*t) */
+    Spectrum::Phase<T> _phase;             /**< Current time and phase tables */
 
 public:
     /** Constructor.
@@ -111,8 +189,10 @@ public:
     * @param windSpeed Speed of wind (m/s).
     * @param waveScale Wave height modifier.
     * @param loopTime Time for animation to repeat (secs).
+    * @param backend FFT implementation to use, NULL for the default.
+    * @param seed Seed of the base amplitudes.
     */
-    Implementation(
+    Core(
         int fourierSize = 64,
         const osg::Vec2f& windDir = osg::Vec2f(1.0f, 1.0f),
         float windSpeed  = 12.f,
@@ -120,17 +200,31 @@ public:
         float reflectionDamping = 0.35f,
         float waveScale = 1e-9,    
         float tileRes = 256.f,
-        float loopTime  = 10.f
+        float loopTime  = 10.f,
+        FFTBackend* backend = NULL,
+        unsigned int seed = 0
         );
 
+    /** Copy constructor.
+    * Copies the spectrum and time, creates a new FFT plan of the same backend.
+    */
+    Core( const Core& copy );
+
     /** Destructor.
     * Cleans up FFT plans and arrays.
     */
-    ~Implementation(void);
+    ~Core(void);
+
+    Implementation* clone( void ) const { return new Core(*this); }
 
-    /** Set the current time and computes the current fourier amplitudes */
+    Precision getPrecision( void ) const { return sizeof(T) == sizeof(float) ? SINGLE_PRECISION : DOUBLE_PRECISION; }
+
+    /** Set the current time and tabulates the phases. The fourier amplitudes are evolved when the fields are computed. */
     void setTime(float time);    
 
+    /** Drops the waves outside [minK, maxK) from the spectrum. */
+    void setWaveNumberRange( float minK, float maxK );
+
     /** Compute the current height field. 
     * Executes an FFT transform to convert the current fourier amplitudes to real height values.
     * @param heights must be created before passing in. Function will resize and overwrite the contents with current data.
@@ -144,101 +238,172 @@ public:
     */
     void computeDisplacements( const float& scaleFactor, osg::Vec2Array* waveDisplacements ) const;
 
+    /** Compute any combination of heights, displacements, slopes, normals, jacobians, 
+    * velocities and accelerations with one batched FFT. NULL arrays are skipped.
+    */
+    void computeFields( osg::FloatArray* heights, 
+                        osg::Vec2Array* waveDisplacements, 
+                        const float& scaleFactor, 
+                        osg::Vec2Array* slopes,
+                        osg::Vec3Array* normals,
+                        osg::FloatArray* jacobians,
+                        osg::Vec3Array* velocities,
+                        osg::Vec3Array* accelerations ) const;
+
+    /** Compute the vertices of an ocean tile, see FFTSimulation::computeTile(). */
+    void computeTile( osg::Vec3Array* vertices, 
+                      float spacing, 
+                      bool displace, 
+                      const float& scaleFactor, 
+                      osg::Vec3Array* normals,
+                      osg::FloatArray* jacobians,
+                      osg::Vec3Array* velocities,
+                      osg::Vec3Array* accelerations ) const;
+
 private:
-    float phillipsSpectrum(const osg::Vec2f& K) const;
+    /** Evolves the amplitudes of the requested fields and transforms them in one batch.
+    * The horizontal velocities and accelerations are transformed along with the 
+    * vertical ones if displacements are requested.
+    * @param outputs receives the transformed field of each Field, NULL if not requested.
+    * @return number of fields transformed, 0 if none were requested.
+    */
+    int transform( bool heights, bool displacements, bool slopes, bool derivatives, 
+                   bool velocities, bool accelerations, const T** outputs ) const;
+
+    /** Normal of the (displaced) surface at sample ptr of the transformed fields. */
+    static osg::Vec3f surfaceNormal( const T* const* outputs, int ptr, bool choppy, const float& scaleFactor );
 
-    /** Computes the base fourier amplitudes htilde0.*/
-    void computeBaseAmplitudes();
+    /** Jacobian determinant of the displaced grid at sample ptr of the transformed fields. */
+    static float jacobian( const T* const* outputs, int ptr, const float& scaleFactor );
 
-    /** Computes the current fourier amplitudes htilde.*/
-    inline void computeCurrentAmplitudes(float time);
+    /** 
+    * Time derivative of the (displaced) surface position at sample ptr, from the 
+    * transformed fields starting at vertical field z, the horizontal ones following it.
+    */
+    static osg::Vec3f motion( const T* const* outputs, int z, int ptr, bool choppy, const float& scaleFactor );
+
+    T phillipsSpectrum(const vec2& K) const;
+
+    /** Computes the base fourier amplitudes htilde0.
+    * Each amplitude only depends on the seed and its wave vector.
+    */
+    void computeBaseAmplitudes( unsigned int seed );
 
     void computeConstants( void );
+
+    /** Points _coeffs and _phase at the arrays of this instance. */
+    void bindArrays( void );
+
+    /** Creates _fftPlan for numFields fields, falling back to the built-in FFT if backend fails. */
+    void createPlan( FFTBackend* backend, int numFields ) const;
 };
 
-FFTSimulation::Implementation::Implementation( int fourierSize,
-                                               const osg::Vec2f& windDir,
-                                               float windSpeed,
-                                               float depth,
-                                               float reflectionDamping,
-                                               float waveScale,
-                                               float tileRes,
-                                               float loopTime ):
+template<typename T>
+FFTSimulation::Core<T>::Core( int fourierSize,
+                              const osg::Vec2f& windDir,
+                              float windSpeed,
+                              float depth,
+                              float reflectionDamping,
+                              float waveScale,
+                              float tileRes,
+                              float loopTime,
+                              FFTBackend* backend,
+                              unsigned int seed ):
     _PI2            ( 2.0*osg::PI ),
     _GRAVITY        ( 9.81 ),
     _GRAVITY2       ( 96.2361 ),
     _N              ( fourierSize ), 
     _numPoints      ( _N*_N ),
     _nOver2         ( fourierSize/2 ),
-    _windDir        ( windDir ), 
+    _spectrumWidth  ( fourierSize/2+1 ),
+    _numSpectrum    ( _N*_spectrumWidth ),
+    _windDir        ( windDir.x(), windDir.y() ), 
     _windSpeed4     ( windSpeed*windSpeed*windSpeed*windSpeed ), 
     _A              ( float(_N)*waveScale ),
     _length         ( tileRes ),
     _w0             ( _PI2 / loopTime ),
+    _loopTime       ( loopTime ),
     _maxWave        ( _windSpeed4/_GRAVITY2 ),
     _depth          ( depth ),
-    _reflDampFactor ( reflectionDamping )
+    _reflDampFactor ( reflectionDamping ),
+    _minK           ( 0.f ),
+    _maxK           ( FLT_MAX )
 {
-    _curAmplitudes.resize( _numPoints );
-    computeBaseAmplitudes();
+    computeBaseAmplitudes( seed );
     computeConstants();
 
-#ifdef USE_FFTW_MALLOC
-    _complexData0 = (fftw_complex*)fftw_malloc(_numPoints * sizeof(fftw_complex));
-    _complexData1 = (fftw_complex*)fftw_malloc(_numPoints * sizeof(fftw_complex));
+    _evolve = getEvolveKernel( T() );
 
-    _realData0 = (fftw_complex*)fftw_malloc(_numPoints * sizeof(fftw_complex));
-    _realData1 = (fftw_complex*)fftw_malloc(_numPoints * sizeof(fftw_complex));
-#else
-    _complexData0 = new fftw_complex[ _numPoints ];
-    _complexData1 = new fftw_complex[ _numPoints ];
-
-    _realData0 = new fftw_complex[ _numPoints ];
-    _realData1 = new fftw_complex[ _numPoints ];
-#endif
+    setTime(0.f);
 
-    _fftPlan0 = fftw_plan_dft_2d( _N, _N, _complexData0, _realData0, FFTW_BACKWARD, FFTW_ESTIMATE );
-    _fftPlan1 = fftw_plan_dft_2d( _N, _N, _complexData1, _realData1, FFTW_BACKWARD, FFTW_ESTIMATE );
+    createPlan( backend ? backend : FFTBackend::getDefaultBackend(), MAX_SURFACE_FIELDS );
 }
 
-FFTSimulation::Implementation::~Implementation()
+template<typename T>
+FFTSimulation::Core<T>::Core( const Core& copy ):
+    _PI2            ( copy._PI2 ),
+    _GRAVITY        ( copy._GRAVITY ),
+    _GRAVITY2       ( copy._GRAVITY2 ),
+    _N              ( copy._N ), 
+    _numPoints      ( copy._numPoints ),
+    _nOver2         ( copy._nOver2 ),
+    _spectrumWidth  ( copy._spectrumWidth ),
+    _numSpectrum    ( copy._numSpectrum ),
+    _windDir        ( copy._windDir ), 
+    _windSpeed4     ( copy._windSpeed4 ), 
+    _A              ( copy._A ),
+    _length         ( copy._length ),
+    _w0             ( copy._w0 ),
+    _loopTime       ( copy._loopTime ),
+    _maxWave        ( copy._maxWave ),
+    _depth          ( copy._depth ),
+    _reflDampFactor ( copy._reflDampFactor ),
+    _minK           ( copy._minK ),
+    _maxK           ( copy._maxK ),
+    _baseAmplitudes ( copy._baseAmplitudes ),
+    _reCos          ( copy._reCos ),
+    _reSin          ( copy._reSin ),
+    _imCos          ( copy._imCos ),
+    _imSin          ( copy._imSin ),
+    _wK             ( copy._wK ),
+    _multiple       ( copy._multiple ),
+    _KhX            ( copy._KhX ),
+    _KhY            ( copy._KhY ),
+    _KX             ( copy._KX ),
+    _KY             ( copy._KY ),
+    _evolve         ( copy._evolve ),
+    _phaseCos       ( copy._phaseCos ),
+    _phaseSin       ( copy._phaseSin ),
+    _phase          ( copy._phase )
 {
-    fftw_destroy_plan(_fftPlan0);
-    fftw_destroy_plan(_fftPlan1);
-
-#ifdef USE_FFTW_MALLOC
-    fftw_free(_complexData0);
-    fftw_free(_complexData1);
-
-    fftw_free(_realData0);
-    fftw_free(_realData1);
-#else
-    delete[] _complexData0;
-    delete[] _complexData1;
+    bindArrays();
+    createPlan( copy._backend.get(), copy._fftPlan.valid() ? copy._fftPlan->getNumFields() : (int)MAX_SURFACE_FIELDS );
+}
 
-    delete[] _realData0;
-    delete[] _realData1;
-#endif
+template<typename T>
+FFTSimulation::Core<T>::~Core()
+{
 }
 
-float FFTSimulation::Implementation::phillipsSpectrum(const osg::Vec2f& K) const
+template<typename T>
+T FFTSimulation::Core<T>::phillipsSpectrum(const vec2& K) const
 {
-    float k2 = K.length2();
+    T k2 = K.length2();
 
     if (k2 == 0.f) 
         return 0.f;
 
-    float k4 = k2 * k2;
+    T k4 = k2 * k2;
 
-    float KdotW = K*_windDir;
+    T KdotW = K*_windDir;
 
-    float KdotWhat = KdotW*KdotW/k2;
+    T KdotWhat = KdotW*KdotW/k2;
 
-    float eterm = exp( -_GRAVITY2 / (k2*_windSpeed4) ) / k4;
+    T eterm = exp( -_GRAVITY2 / (k2*_windSpeed4) ) / k4;
 
-    const float damping = 0.000001f;
+    const T damping = 0.000001f;
 
-    float specResult = _A * eterm * KdotWhat * exp( -k2 * _maxWave * damping );    
+    T specResult = _A * eterm * KdotWhat * exp( -k2 * _maxWave * damping );    
 
     if (KdotW < 0.f)    
         specResult *= _reflDampFactor;
@@ -246,12 +411,13 @@ float FFTSimulation::Implementation::phillipsSpectrum(const osg::Vec2f& K) const
     return specResult;
 }
 
-void FFTSimulation::Implementation::computeBaseAmplitudes()
+template<typename T>
+void FFTSimulation::Core<T>::computeBaseAmplitudes( unsigned int seed )
 {
     _baseAmplitudes.resize( (_N+1)*(_N+1) );
 
-    osg::Vec2 K;
-    float oneOverLen = 1.f / _length;
+    vec2 K;
+    T oneOverLen = T(1) / _length;
     float real,imag;
 
     for (int y = 0, y2 = -_nOver2; y <= _N; ++y, ++y2) 
@@ -262,156 +428,550 @@ void FFTSimulation::Implementation::computeBaseAmplitudes()
         {
             K.x() = _PI2*x2*oneOverLen;
 
-            RandUtils::gaussianRand(real,imag);
+            // Keyed by the wave vector rather than the array position, so a 
+            // wave keeps its amplitude and phase when the grid size changes.
+            unsigned long long counter = (unsigned long long)(unsigned int)y2 << 32 | (unsigned int)x2;
 
-#if defined(USE_FFTW3F)
-            _baseAmplitudes[y*(_N+1)+x] = complex(real,imag) * sqrtf( 0.5f * phillipsSpectrum(K) );
-#else
-            _baseAmplitudes[y*(_N+1)+x] = complex(real,imag) * sqrt( 0.5 * (double)phillipsSpectrum(K) );
-#endif
+            RandUtils::gaussianRand(seed,counter,real,imag);
+
+            _baseAmplitudes[y*(_N+1)+x] = complex(real,imag) * (T)sqrt( 0.5 * (double)phillipsSpectrum(K) );
         }
     }
 }
 
-void FFTSimulation::Implementation::computeConstants( void )
+template<typename T>
+void FFTSimulation::Core<T>::computeConstants( void )
 {
-    float oneOverLen = 1.f/(float)_length;
-
-    _h0TildeK.resize(_numPoints);
-    _h0TildeKconj.resize(_numPoints);
-    _wK.resize(_numPoints);
-    _Kh.resize(_numPoints);
+    T oneOverLen = T(1)/_length;
+
+    _reCos.resize(_numSpectrum);
+    _reSin.resize(_numSpectrum);
+    _imCos.resize(_numSpectrum);
+    _imSin.resize(_numSpectrum);
+    _wK.resize(_numSpectrum);
+    _multiple.resize(_numSpectrum);
+    _KhX.resize(_numSpectrum);
+    _KhY.resize(_numSpectrum);
+    _KX.resize(_numSpectrum);
+    _KY.resize(_numSpectrum);
 
     int ptr = 0;
 
-    osg::Vec2 K;
-    osg::Vec2 Kh0(0,0);
+    vec2 K;
+    vec2 Kh;
     
-    float klen = 0.f;
-    float wK  = 0.f;
+    T klen = 0.f;
+    T wK  = 0.f;
+    int maxMultiple = 0;
 
+    // The spectrum is laid out transposed with respect to the base amplitudes
+    // so that every field comes out of the FFT in the same orientation as 
+    // the height field has always had, without transposing on the way in or out.
     for(int y = 0; y < _N; ++y )
     {
-        K.y() = _PI2 * ( (float)(y-_nOver2) * oneOverLen );
+        K.y() = _PI2 * ( (T)(y-_nOver2) * oneOverLen );
 
-        for( int x = 0; x < _N; ++x )
+        for( int x = 0; x < _spectrumWidth; ++x )
         {
-            K.x() = _PI2 * ( (float)(x-_nOver2) * oneOverLen );
-
-            ptr = y*_N+x;
-
-            _h0TildeK[ptr] = _baseAmplitudes[ y*(_N+1)+x ];
-            _h0TildeKconj[ptr] = conj( _baseAmplitudes[ (_N-y)*(_N+1)+(_N-x) ] );
+            K.x() = _PI2 * ( (T)(x-_nOver2) * oneOverLen );
+
+            // K starts at -N/2, so transforming the samples where they are would
+            // multiply the fields by (-1)^(x+y). Storing each sample as its 
+            // conjugate, ie. as the sample of -K, mirrored about N/2 in both 
+            // directions folds that sign into the spectrum instead.
+            ptr = ((_N+_nOver2-y) % _N)*_spectrumWidth + (_nOver2-x);
+
+            // The FFT backends only read the non-redundant half of the spectrum
+            // and assume h(-k) == conj(h(k)). That holds for every sample except the -N/2 row and column, where 
+            // -k wraps back onto the grid but the (N+1)^2 base amplitudes differ.
+            // Averaging with the mirror sample gives exactly the real part a 
+            // plain complex transform would produce.
+            int yMirror = (_N-y) % _N;
+            int xMirror = (_N-x) % _N;
+
+            complex h0K         = _baseAmplitudes[ x*(_N+1)+y ];
+            complex h0Kconj     = conj( _baseAmplitudes[ (_N-x)*(_N+1)+(_N-y) ] );
+            complex mirrorK     = _baseAmplitudes[ xMirror*(_N+1)+yMirror ];
+            complex mirrorKconj = conj( _baseAmplitudes[ (_N-xMirror)*(_N+1)+(_N-yMirror) ] );
+
+            complex H = ( h0K     + conj(mirrorKconj) ) * T(0.5);
+            complex C = ( h0Kconj + conj(mirrorK)     ) * T(0.5);
+
+            _reCos[ptr] = H.real() + C.real();
+            _reSin[ptr] = C.imag() - H.imag();
+            _imCos[ptr] = -( H.imag() + C.imag() );
+            _imSin[ptr] = -( H.real() - C.real() );
 
             klen = K.length();
 
+            if (klen < _minK || klen >= _maxK)
+            {
+                _reCos[ptr] = _reSin[ptr] = _imCos[ptr] = _imSin[ptr] = 0.f;
+            }
+
             wK = sqrt( _GRAVITY * klen * tanh(klen*_depth) );
-            _wK[ptr] = floor(wK/_w0)*_w0;
+            _multiple[ptr] = (int)floor(wK/_w0);
+            _wK[ptr] = _multiple[ptr]*_w0;
+
+            maxMultiple = osg::maximum( maxMultiple, _multiple[ptr] );
 
             if (klen != 0)
-                _Kh[ptr] = K * (1.f/klen);
+                Kh = K * (T(1)/klen);
             else
-                _Kh[ptr] = Kh0;
+                Kh.set(0.f,0.f);
+
+            _KhX[ptr] = -Kh.x();  _KhY[ptr] = -Kh.y();
+            _KX[ptr]  = -K.x();   _KY[ptr]  = -K.y();
+
+            // The derivative of the Nyquist frequency has no real representation,
+            // drop it rather than feed a non-Hermitian spectrum to the transform.
+            if (x == 0) { _KhX[ptr] = 0.f; _KX[ptr] = 0.f; }
+            if (y == 0) { _KhY[ptr] = 0.f; _KY[ptr] = 0.f; }
         }
     }
+
+    // All phases are powers of exp(i*_w0*t). Unless the loop time is so long
+    // that there are more distinct multiples than samples, tabulate them once 
+    // per time step instead of evaluating sin and cos for every sample.
+    if (maxMultiple < _numSpectrum)
+    {
+        _phaseCos.resize( maxMultiple+1 );
+        _phaseSin.resize( maxMultiple+1 );
+    }
+    else
+    {
+        _phaseCos.clear();
+        _phaseSin.clear();
+    }
+
+    bindArrays();
 }
 
-void FFTSimulation::Implementation::computeCurrentAmplitudes(float time)
+template<typename T>
+void FFTSimulation::Core<T>::bindArrays( void )
 {
-    for (int y = 0; y < _N; ++y) 
+    _coeffs.reCos = &_reCos.front();
+    _coeffs.reSin = &_reSin.front();
+    _coeffs.imCos = &_imCos.front();
+    _coeffs.imSin = &_imSin.front();
+    _coeffs.w     = &_wK.front();
+    _coeffs.multiple = &_multiple.front();
+    _coeffs.khX   = &_KhX.front();
+    _coeffs.khY   = &_KhY.front();
+    _coeffs.kX    = &_KX.front();
+    _coeffs.kY    = &_KY.front();
+
+    if (!_phaseCos.empty())
     {
-        for (int x = 0; x < _N; ++x) 
-        {
-            int ptr = y*_N+x;
+        _phase.cosTable = &_phaseCos.front();
+        _phase.sinTable = &_phaseSin.front();
+    }
+    else
+    {
+        _phase.cosTable = NULL;
+        _phase.sinTable = NULL;
+    }
+}
 
-            float wT = _wK[ptr] * time;
-            float cwT = cos(wT);
-            float swT = sin(wT);
+template<typename T>
+void FFTSimulation::Core<T>::createPlan( FFTBackend* backend, int numFields ) const
+{
+    _backend = backend;
+    _fftPlan = NULL;
 
-            _curAmplitudes[y*_N+x] = _h0TildeK[ptr] * complex(cwT, swT) + _h0TildeKconj[ptr] * complex(cwT, -swT);
-        }
+    if (_backend.valid())
+        _fftPlan = _backend->createPlan( _N, numFields, T() );
+
+    if (!_fftPlan.valid() && _backend != FFTBackend::getBackend("builtin"))
+    {
+        osg::notify(osg::WARN) << "osgOcean: FFT backend failed to create a plan, using the built-in FFT." << std::endl;
+
+        _backend = FFTBackend::getBackend("builtin");
+        _fftPlan = _backend->createPlan( _N, numFields, T() );
     }
+
+    if (!_fftPlan.valid())
+        osg::notify(osg::WARN) << "osgOcean: Unable to create an FFT plan of size " << _N << "." << std::endl;
 }
 
-void FFTSimulation::Implementation::setTime(float time)
+template<typename T>
+void FFTSimulation::Core<T>::setTime(float time)
 {
-    computeCurrentAmplitudes(time);
+    // Every frequency is a whole multiple of _w0 so the spectrum repeats
+    // exactly every _loopTime. Wrapping keeps w*t small, which is where
+    // float sin/cos are accurate.
+    _phase.time = fmod( (T)time, _loopTime );
+
+    if (_phase.time < 0.f)
+        _phase.time += _loopTime;
+
+    // Advance by complex multiplication, in double so the error stays far 
+    // below float precision over the few hundred multiples in use.
+    const std::complex<double> step = std::polar( 1.0, (double)_w0 * _phase.time );
+    std::complex<double> rotation( 1.0, 0.0 );
+
+    for (unsigned int m = 0; m < _phaseCos.size(); ++m)
+    {
+        _phaseCos[m] = (T)rotation.real();
+        _phaseSin[m] = (T)rotation.imag();
+        rotation *= step;
+    }
 }
 
-void FFTSimulation::Implementation::computeHeights( osg::FloatArray* waveheights ) const
+template<typename T>
+void FFTSimulation::Core<T>::setWaveNumberRange( float minK, float maxK )
 {
-    // populate input array
-    for(int y = 0; y < _N; ++y )
+    _minK = minK;
+    _maxK = maxK;
+
+    computeConstants();
+
+    // the phase tables may have been resized
+    setTime( _phase.time );
+}
+
+template<typename T>
+void FFTSimulation::Core<T>::computeHeights( osg::FloatArray* waveheights ) const
+{
+    computeFields( waveheights, NULL, 0.f, NULL, NULL, NULL, NULL, NULL );
+}
+
+template<typename T>
+void FFTSimulation::Core<T>::computeDisplacements(const float& scaleFactor, 
+                                                  osg::Vec2Array* waveDisplacements) const
+{
+    computeFields( NULL, waveDisplacements, scaleFactor, NULL, NULL, NULL, NULL, NULL );
+}
+
+template<typename T>
+int FFTSimulation::Core<T>::transform( bool heights, 
+                                       bool displacements, 
+                                       bool slopes, 
+                                       bool derivatives,
+                                       bool velocities,
+                                       bool accelerations,
+                                       const T** outputs ) const
+{
+    // Slot of each requested field within the batch, -1 if not requested.
+    int slot[MAX_FIELDS];
+    int numFields = 0;
+
+    slot[HEIGHT]          = heights       ? numFields++ : -1;
+    slot[DISPLACEMENT_X]  = displacements ? numFields++ : -1;
+    slot[DISPLACEMENT_Y]  = displacements ? numFields++ : -1;
+    slot[SLOPE_X]         = slopes        ? numFields++ : -1;
+    slot[SLOPE_Y]         = slopes        ? numFields++ : -1;
+    slot[DISPLACEMENT_XX] = derivatives   ? numFields++ : -1;
+    slot[DISPLACEMENT_YY] = derivatives   ? numFields++ : -1;
+    slot[DISPLACEMENT_XY] = derivatives   ? numFields++ : -1;
+    slot[VELOCITY_Z]      = velocities    ? numFields++ : -1;
+    slot[VELOCITY_X]      = velocities && displacements ? numFields++ : -1;
+    slot[VELOCITY_Y]      = velocities && displacements ? numFields++ : -1;
+    slot[ACCELERATION_Z]  = accelerations ? numFields++ : -1;
+    slot[ACCELERATION_X]  = accelerations && displacements ? numFields++ : -1;
+    slot[ACCELERATION_Y]  = accelerations && displacements ? numFields++ : -1;
+
+    if (numFields == 0 || !_fftPlan.valid())
+        return 0;
+
+    if (numFields > _fftPlan->getNumFields())
     {
-        for (int x = 0; x < _N; ++x) 
-        {
-            int ptr = y*_N+x;
+        createPlan( _backend.get(), MAX_FIELDS );
 
-            _complexData0[ptr][0] = _curAmplitudes[ptr].real();
-            _complexData0[ptr][1] = _curAmplitudes[ptr].imag();
-        }
+        if (!_fftPlan.valid())
+            return 0;
     }
 
-    fftw_execute(_fftPlan0);
+    // Evolve the amplitudes straight into the inputs of the batched transform.
+    complex* inputs[MAX_FIELDS];
 
-    if (waveheights->size() != (unsigned int)(_numPoints) ){
-        waveheights->resize(_numPoints);
-    }
+    for (int f = 0; f < MAX_FIELDS; ++f)
+        inputs[f] = slot[f] >= 0 ? _fftPlan->getSpectrum(slot[f]) : NULL;
+
+    _evolve( _coeffs, _numSpectrum, _phase, inputs );
+
+    _fftPlan->execute(numFields);
 
-    const float signs[2] = { 1.f, -1.f };
+    for (int f = 0; f < MAX_FIELDS; ++f)
+        outputs[f] = slot[f] >= 0 ? _fftPlan->getField(slot[f]) : NULL;
 
-    for(int y = 0; y < _N; ++y)
+    return numFields;
+}
+
+template<typename T>
+osg::Vec3f FFTSimulation::Core<T>::surfaceNormal( const T* const* outputs, 
+                                                  int ptr, 
+                                                  bool choppy, 
+                                                  const float& scaleFactor )
+{
+    // Tangents of the surface p(u,v) = (u+Dx, -v+Dy, h) that 
+    // OceanTile builds, rows running down the y axis.
+    osg::Vec3f du( 1.f, 0.f, outputs[SLOPE_X][ptr] );
+    osg::Vec3f dv( 0.f,-1.f, outputs[SLOPE_Y][ptr] );
+
+    if (choppy)
     {
-        for(int x = 0; x < _N; ++x )
-        {
-            waveheights->at(y*_N+x) = _realData0[x*_N+y][0]  * signs[(x + y) & 1];
-        }
+        // Derivatives of the scaled displacements
+        const T dxx = outputs[DISPLACEMENT_XX][ptr] * scaleFactor;
+        const T dyy = outputs[DISPLACEMENT_YY][ptr] * scaleFactor;
+        const T dxy = outputs[DISPLACEMENT_XY][ptr] * scaleFactor;
+
+        du.x() += dxx;
+        du.y() += dxy;
+        dv.x() += dxy;
+        dv.y() += dyy;
     }
+
+    osg::Vec3f n = dv ^ du;
+    n.normalize();
+
+    return n;
+}
+
+template<typename T>
+float FFTSimulation::Core<T>::jacobian( const T* const* outputs, 
+                                        int ptr, 
+                                        const float& scaleFactor )
+{
+    const T dxx = outputs[DISPLACEMENT_XX][ptr] * scaleFactor;
+    const T dyy = outputs[DISPLACEMENT_YY][ptr] * scaleFactor;
+    const T dxy = outputs[DISPLACEMENT_XY][ptr] * scaleFactor;
+
+    // Area scale of the same surface, the rows run down y.
+    return (1.f+dxx)*(1.f-dyy) + dxy*dxy;
 }
 
-void FFTSimulation::Implementation::computeDisplacements(const float& scaleFactor, 
-                                                         osg::Vec2Array* waveDisplacements) const
+template<typename T>
+osg::Vec3f FFTSimulation::Core<T>::motion( const T* const* outputs, 
+                                           int z, 
+                                           int ptr, 
+                                           bool choppy, 
+                                           const float& scaleFactor )
 {
-    for (int y = 0; y < _N; ++y) 
+    // The horizontal fields follow the vertical one, see Field.
+    if (!choppy)
+        return osg::Vec3f( 0.f, 0.f, outputs[z][ptr] );
+
+    return osg::Vec3f( outputs[z+1][ptr] * scaleFactor, 
+                       outputs[z+2][ptr] * scaleFactor, 
+                       outputs[z][ptr] );
+}
+
+template<typename T>
+void FFTSimulation::Core<T>::computeFields( osg::FloatArray* waveheights, 
+                                            osg::Vec2Array* waveDisplacements, 
+                                            const float& scaleFactor, 
+                                            osg::Vec2Array* slopes,
+                                            osg::Vec3Array* normals,
+                                            osg::FloatArray* jacobians,
+                                            osg::Vec3Array* velocities,
+                                            osg::Vec3Array* accelerations ) const
+{
+    // Normals of a choppy surface also depend on how the displacements
+    // stretch and shear the grid.
+    const bool choppyNormals = normals && waveDisplacements;
+
+    const T* outputs[MAX_FIELDS];
+
+    if (!transform( waveheights != NULL, 
+                    waveDisplacements != NULL, 
+                    slopes || normals, 
+                    choppyNormals || jacobians, 
+                    velocities != NULL,
+                    accelerations != NULL,
+                    outputs ))
+        return;
+
+    if (waveheights && waveheights->size() != (unsigned int)(_numPoints) )
+        waveheights->resize(_numPoints);
+
+    if (waveDisplacements && waveDisplacements->size() != (unsigned int)(_numPoints) )
+        waveDisplacements->resize(_numPoints);
+
+    if (slopes && slopes->size() != (unsigned int)(_numPoints) )
+        slopes->resize(_numPoints);
+
+    if (normals && normals->size() != (unsigned int)(_numPoints) )
+        normals->resize(_numPoints);
+
+    if (jacobians && jacobians->size() != (unsigned int)(_numPoints) )
+        jacobians->resize(_numPoints);
+
+    if (velocities && velocities->size() != (unsigned int)(_numPoints) )
+        velocities->resize(_numPoints);
+
+    if (accelerations && accelerations->size() != (unsigned int)(_numPoints) )
+        accelerations->resize(_numPoints);
+
+    // The spectrum carries the (-1)^(x+y) shift of the transform,
+    // so the outputs are the final row major fields.
+    for (int ptr = 0; ptr < _numPoints; ++ptr)
     {
-        for (int x = 0; x < _N; ++x) 
+        if (waveheights)
         {
-            int ptr = y*_N+x;
-            int flipPtr = x*_N+y;
+            (*waveheights)[ptr] = outputs[HEIGHT][ptr];
+        }
 
-            const complex& c = _curAmplitudes[ptr];
+        if (waveDisplacements)
+        {
+            (*waveDisplacements)[ptr].set( outputs[DISPLACEMENT_X][ptr] * scaleFactor, 
+                                           outputs[DISPLACEMENT_Y][ptr] * scaleFactor );
+        }
 
-            _complexData0[flipPtr][0] =  c.imag() * _Kh[ptr].x();
-            _complexData0[flipPtr][1] = -c.real() * _Kh[ptr].x();
+        if (slopes)
+        {
+            (*slopes)[ptr].set( outputs[SLOPE_X][ptr], 
+                                outputs[SLOPE_Y][ptr] );
+        }
 
-            _complexData1[flipPtr][0] =  c.imag() * _Kh[ptr].y();
-            _complexData1[flipPtr][1] = -c.real() * _Kh[ptr].y();
+        if (normals)
+        {
+            (*normals)[ptr] = surfaceNormal( outputs, ptr, choppyNormals, scaleFactor );
+        }
+
+        if (jacobians)
+        {
+            (*jacobians)[ptr] = jacobian( outputs, ptr, scaleFactor );
+        }
+
+        if (velocities)
+        {
+            (*velocities)[ptr] = motion( outputs, VELOCITY_Z, ptr, waveDisplacements != NULL, scaleFactor );
+        }
+
+        if (accelerations)
+        {
+            (*accelerations)[ptr] = motion( outputs, ACCELERATION_Z, ptr, waveDisplacements != NULL, scaleFactor );
         }
     }
+}
 
-    fftw_execute(_fftPlan0);
-    fftw_execute(_fftPlan1);
+template<typename T>
+void FFTSimulation::Core<T>::computeTile( osg::Vec3Array* vertices, 
+                                          float spacing, 
+                                          bool displace, 
+                                          const float& scaleFactor, 
+                                          osg::Vec3Array* normals,
+                                          osg::FloatArray* jacobians,
+                                          osg::Vec3Array* velocities,
+                                          osg::Vec3Array* accelerations ) const
+{
+    if (!vertices)
+        return;
 
-    if (waveDisplacements->size() != (unsigned int)(_numPoints) )
-        waveDisplacements->resize(_numPoints);
+    const T* outputs[MAX_FIELDS];
 
-    const float signs[2] = { 1.f, -1.f };
+    if (!transform( true, 
+                    displace, 
+                    normals != NULL, 
+                    (normals && displace) || jacobians, 
+                    velocities != NULL,
+                    accelerations != NULL,
+                    outputs ))
+        return;
 
-    unsigned int ptr = 0;
+    const int rowLength = _N+1;
+    const unsigned int numVertices = rowLength*rowLength;
 
-    osg::Vec2 real;
+    if (vertices->size() != numVertices)
+        vertices->resize(numVertices);
+
+    if (normals && normals->size() != numVertices)
+        normals->resize(numVertices);
+
+    if (velocities && velocities->size() != numVertices)
+        velocities->resize(numVertices);
+
+    if (accelerations && accelerations->size() != numVertices)
+        accelerations->resize(numVertices);
+
+    if (jacobians && jacobians->size() != (unsigned int)(_numPoints) )
+        jacobians->resize(_numPoints);
+
+    const float tileSize = _N*spacing;
 
     for (int y = 0; y < _N; ++y)
     {
-        for (int x = 0; x < _N; ++x) 
+        const T* h = outputs[HEIGHT] + y*_N;
+        osg::Vec3f* v = &(*vertices)[y*rowLength];
+
+        for (int x = 0; x < _N; ++x)
         {
-            ptr = x*_N+y;
+            v[x].set( x*spacing, -y*spacing, h[x] );
+        }
+
+        if (displace)
+        {
+            const T* dx = outputs[DISPLACEMENT_X] + y*_N;
+            const T* dy = outputs[DISPLACEMENT_Y] + y*_N;
+
+            for (int x = 0; x < _N; ++x)
+            {
+                v[x].x() += dx[x] * scaleFactor;
+                v[x].y() += dy[x] * scaleFactor;
+            }
+        }
+
+        if (normals)
+        {
+            osg::Vec3f* n = &(*normals)[y*rowLength];
+
+            for (int x = 0; x < _N; ++x)
+            {
+                n[x] = surfaceNormal( outputs, y*_N+x, displace, scaleFactor );
+            }
 
-            double s = signs[(x + y) & 1];
-            real.x() = _realData0[ptr][0];
-            real.y() = _realData1[ptr][0];
-            waveDisplacements->at(y*_N+x) = real * s * (double)scaleFactor;
+            n[_N] = n[0];
         }
+
+        if (velocities)
+        {
+            osg::Vec3f* m = &(*velocities)[y*rowLength];
+
+            for (int x = 0; x < _N; ++x)
+                m[x] = motion( outputs, VELOCITY_Z, y*_N+x, displace, scaleFactor );
+
+            m[_N] = m[0];
+        }
+
+        if (accelerations)
+        {
+            osg::Vec3f* m = &(*accelerations)[y*rowLength];
+
+            for (int x = 0; x < _N; ++x)
+                m[x] = motion( outputs, ACCELERATION_Z, y*_N+x, displace, scaleFactor );
+
+            m[_N] = m[0];
+        }
+
+        // The skirt column repeats the first one a tile further along.
+        v[_N] = v[0];
+        v[_N].x() += tileSize;
+    }
+
+    // As does the skirt row.
+    osg::Vec3f* first = &(*vertices)[0];
+    osg::Vec3f* last  = &(*vertices)[_N*rowLength];
+
+    for (int x = 0; x < rowLength; ++x)
+    {
+        last[x] = first[x];
+        last[x].y() -= tileSize;
+    }
+
+    if (normals)
+        std::copy( normals->begin(), normals->begin()+rowLength, normals->begin()+_N*rowLength );
+
+    if (velocities)
+        std::copy( velocities->begin(), velocities->begin()+rowLength, velocities->begin()+_N*rowLength );
+
+    if (accelerations)
+        std::copy( accelerations->begin(), accelerations->begin()+rowLength, accelerations->begin()+_N*rowLength );
+
+    if (jacobians)
+    {
+        for (int ptr = 0; ptr < _numPoints; ++ptr)
+            (*jacobians)[ptr] = jacobian( outputs, ptr, scaleFactor );
     }
 }
 
@@ -423,8 +983,19 @@ FFTSimulation::FFTSimulation( int fourierSize,
                               float reflectionDamping,
                               float waveScale,
                               float tileRes,
-                              float loopTime)
-    : _implementation( new Implementation(fourierSize, windDir, windSpeed, depth, reflectionDamping, waveScale, tileRes, loopTime) )
+                              float loopTime,
+                              FFTBackend* backend,
+                              unsigned int seed,
+                              Precision precision )
+{
+    if (precision == DOUBLE_PRECISION)
+        _implementation = new Core<double>(fourierSize, windDir, windSpeed, depth, reflectionDamping, waveScale, tileRes, loopTime, backend, seed);
+    else
+        _implementation = new Core<float>(fourierSize, windDir, windSpeed, depth, reflectionDamping, waveScale, tileRes, loopTime, backend, seed);
+}
+
+FFTSimulation::FFTSimulation( const FFTSimulation& copy )
+    : _implementation( copy._implementation->clone() )
 {
 }
 
@@ -433,11 +1004,21 @@ FFTSimulation::~FFTSimulation()
     delete _implementation;
 }
 
+FFTSimulation::Precision FFTSimulation::getPrecision( void ) const
+{
+    return _implementation->getPrecision();
+}
+
 void FFTSimulation::setTime(float time)
 {
     _implementation->setTime(time);
 }
 
+void FFTSimulation::setWaveNumberRange( float minK, float maxK )
+{
+    _implementation->setWaveNumberRange(minK, maxK);
+}
+
 void FFTSimulation::computeHeights( osg::FloatArray* heights ) const
 {
     _implementation->computeHeights(heights);
@@ -447,3 +1028,27 @@ void FFTSimulation::computeDisplacements( const float& scaleFactor, osg::Vec2Arr
 {
     _implementation->computeDisplacements(scaleFactor, waveDisplacements);
 }
+
+void FFTSimulation::computeFields( osg::FloatArray* heights, 
+                                   osg::Vec2Array* waveDisplacements, 
+                                   const float& scaleFactor, 
+                                   osg::Vec2Array* slopes,
+                                   osg::Vec3Array* normals,
+                                   osg::FloatArray* jacobians,
+                                   osg::Vec3Array* velocities,
+                                   osg::Vec3Array* accelerations ) const
+{
+    _implementation->computeFields(heights, waveDisplacements, scaleFactor, slopes, normals, jacobians, velocities, accelerations);
+}
+
+void FFTSimulation::computeTile( osg::Vec3Array* vertices, 
+                                 float spacing, 
+                                 bool displace, 
+                                 const float& scaleFactor, 
+                                 osg::Vec3Array* normals,
+                                 osg::FloatArray* jacobians,
+                                 osg::Vec3Array* velocities,
+                                 osg::Vec3Array* accelerations ) const
+{
+    _implementation->computeTile(vertices, spacing, displace, scaleFactor, normals, jacobians, velocities, accelerations);
+}
@@ -0,0 +1,28 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+#include "SpectrumKernels.h"
+
+void osgOcean::Spectrum::evolveAVX2( const Coefficients<float>& coeffs, int count, const Phase<float>& phase, std::complex<float>* const* outputs )
+{
+    evolve<SIMD::AVXFloat>( coeffs, count, phase, outputs );
+}
+
+void osgOcean::Spectrum::evolveAVX2( const Coefficients<double>& coeffs, int count, const Phase<double>& phase, std::complex<double>* const* outputs )
+{
+    evolve<SIMD::AVXDouble>( coeffs, count, phase, outputs );
+}
@@ -0,0 +1,109 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+#include "MappedFile.h"
+
+#if defined(_WIN32)
+  #define WIN32_LEAN_AND_MEAN
+  #include <windows.h>
+#else
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <fcntl.h>
+  #include <unistd.h>
+#endif
+
+using namespace osgOcean;
+
+MappedFile::MappedFile( void )
+    :_data ( NULL )
+    ,_size ( 0 )
+#if defined(_WIN32)
+    ,_file   ( INVALID_HANDLE_VALUE )
+    ,_mapping( NULL )
+#else
+    ,_file ( -1 )
+#endif
+{}
+
+MappedFile::~MappedFile( void )
+{
+#if defined(_WIN32)
+    if (_data)
+        UnmapViewOfFile( _data );
+
+    if (_mapping)
+        CloseHandle( _mapping );
+
+    if (_file != INVALID_HANDLE_VALUE)
+        CloseHandle( _file );
+#else
+    if (_data)
+        munmap( const_cast<unsigned char*>(_data), _size );
+
+    if (_file >= 0)
+        close( _file );
+#endif
+}
+
+MappedFile* MappedFile::open( const std::string& path )
+{
+    osg::ref_ptr<MappedFile> file = new MappedFile;
+
+#if defined(_WIN32)
+    file->_file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+
+    if (file->_file == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    LARGE_INTEGER size;
+
+    if (!GetFileSizeEx( file->_file, &size ) || size.QuadPart == 0)
+        return NULL;
+
+    file->_mapping = CreateFileMappingA( file->_file, NULL, PAGE_WRITECOPY, 0, 0, NULL );
+
+    if (!file->_mapping)
+        return NULL;
+
+    file->_data = static_cast<const unsigned char*>( MapViewOfFile( file->_mapping, FILE_MAP_COPY, 0, 0, 0 ) );
+    file->_size = (size_t)size.QuadPart;
+#else
+    file->_file = ::open( path.c_str(), O_RDONLY );
+
+    if (file->_file < 0)
+        return NULL;
+
+    struct stat info;
+
+    if (fstat( file->_file, &info ) != 0 || info.st_size == 0)
+        return NULL;
+
+    // copy on write, so that the images viewing the file can be written to like any other
+    void* data = mmap( NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, file->_file, 0 );
+
+    if (data == MAP_FAILED)
+        return NULL;
+
+    file->_data = static_cast<const unsigned char*>( data );
+    file->_size = (size_t)info.st_size;
+#endif
+
+    if (!file->_data)
+        return NULL;
+
+    return file.release();
+}
@@ -0,0 +1,61 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to osgOcean. View of a whole file, mapped into memory so that the
+// pages are loaded on demand and shared between the processes that map the
+// same file. The mapping is private and writable: a page written to becomes
+// a copy of the process, the file itself is never changed.
+
+#pragma once
+
+#include <osg/Referenced>
+#include <osg/ref_ptr>
+
+#include <string>
+
+namespace osgOcean
+{
+    class MappedFile : public osg::Referenced
+    {
+    public:
+        /** @return the mapped file, NULL if it does not exist or cannot be mapped. */
+        static MappedFile* open( const std::string& path );
+
+        inline const unsigned char* data( void ) const{
+            return _data;
+        }
+
+        inline size_t size( void ) const{
+            return _size;
+        }
+
+    protected:
+        MappedFile( void );
+        ~MappedFile( void );
+
+    private:
+        const unsigned char* _data;
+        size_t _size;
+
+#if defined(_WIN32)
+        void* _file;
+        void* _mapping;
+#else
+        int _file;
+#endif
+    };
+}
@@ -0,0 +1,71 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to OceanTile. Reduces the rows of a geomipmap level to the next
+// level with a 2x2 box filter. Instantiated for scalar and SSE2 code in
+// OceanTile.cpp and for AVX2 in OceanTileAVX2.cpp.
+
+#pragma once
+#include "SIMD.h"
+
+namespace osgOcean
+{
+    namespace Mipmap
+    {
+        /**
+        * Averages the 2x2 blocks of xyz vectors of the rows a and b into count
+        * vectors: out[j] = (a[2j] + a[2j+1] + b[2j] + b[2j+1]) / 4. The rows hold
+        * at least 2*count vectors, scratch 6*count floats.
+        */
+        typedef void (*ReduceFunc)( const float* a, const float* b, float* out, int count, float* scratch );
+
+        template<class V>
+        void reduce( const float* a, const float* b, float* out, int count, float* scratch )
+        {
+            typedef typename V::type vec;
+
+            // Vectors are 3 floats, so a float and the one 3 further along belong to
+            // horizontally adjacent vectors. The sums of every pair are taken over
+            // the flat rows and the even vectors picked out afterwards.
+            const int n = 6*count - 3;
+            const vec quarter = V::set1(0.25f);
+
+            int i = 0;
+
+            for (; i+V::width <= n; i += V::width)
+            {
+                const vec top    = V::add( V::load(a+i), V::load(a+i+3) );
+                const vec bottom = V::add( V::load(b+i), V::load(b+i+3) );
+
+                V::store( scratch+i, V::mul( V::add(top,bottom), quarter ) );
+            }
+
+            for (; i < n; ++i)
+                scratch[i] = ( (a[i]+a[i+3]) + (b[i]+b[i+3]) ) * 0.25f;
+
+            for (int j = 0; j < count; ++j)
+            {
+                out[3*j  ] = scratch[6*j  ];
+                out[3*j+1] = scratch[6*j+1];
+                out[3*j+2] = scratch[6*j+2];
+            }
+        }
+
+        /** AVX2 instantiation, defined in OceanTileAVX2.cpp. */
+        void reduceAVX2( const float* a, const float* b, float* out, int count, float* scratch );
+    }
+}
@@ -0,0 +1,166 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+#include "NormalMaps.h"
+
+#include <vector>
+#include <cmath>
+
+using namespace osgOcean;
+
+namespace
+{
+    /** Blocks of 4x4 texels along a side of a mipmap level, levels under 4 texels fill one block. */
+    inline unsigned int numBlocks( unsigned int size )
+    {
+        return (size+3)/4;
+    }
+
+    // A channel of a block holds two signed 8 bit endpoints and a 3 bit code 
+    // for each of its 16 texels. With red0 > red1 code 0 is red0, code 1 red1
+    // and codes 2-7 the six values in between, from red0 towards red1.
+    void encodeChannel( const float* values, unsigned char* block )
+    {
+        float minValue = values[0];
+        float maxValue = values[0];
+
+        for (unsigned int i = 1; i < 16; ++i)
+        {
+            minValue = osg::minimum( minValue, values[i] );
+            maxValue = osg::maximum( maxValue, values[i] );
+        }
+
+        const int hi = (int)floorf( osg::clampBetween( maxValue, -1.f, 1.f ) * 127.f + 0.5f );
+        const int lo = (int)floorf( osg::clampBetween( minValue, -1.f, 1.f ) * 127.f + 0.5f );
+
+        block[0] = (unsigned char)(signed char)hi;
+        block[1] = (unsigned char)(signed char)lo;
+
+        unsigned long long codes = 0;
+
+        // a constant channel is all code 0, whatever the mode
+        if (hi > lo)
+        {
+            const float scale = 7.f / float(hi - lo);
+
+            for (unsigned int i = 0; i < 16; ++i)
+            {
+                // steps from lo towards hi
+                const int step = osg::clampBetween( (int)floorf( ( values[i]*127.f - float(lo) ) * scale + 0.5f ), 0, 7 );
+                const unsigned long long code = step == 7 ? 0 : step == 0 ? 1 : 8 - step;
+
+                codes |= code << (3*i);
+            }
+        }
+
+        for (unsigned int b = 0; b < 6; ++b)
+            block[2+b] = (unsigned char)( codes >> (8*b) );
+    }
+
+    /** Encodes a size*size level, repeating it to fill blocks larger than the level. */
+    unsigned char* encodeLevel( const osg::Vec3f* normals, unsigned int size, unsigned char* dst )
+    {
+        float xs[16], ys[16];
+
+        for (unsigned int by = 0; by < numBlocks(size); ++by)
+        {
+            for (unsigned int bx = 0; bx < numBlocks(size); ++bx)
+            {
+                for (unsigned int i = 0; i < 16; ++i)
+                {
+                    const unsigned int x = (bx*4 + i%4) % size;
+                    const unsigned int y = (by*4 + i/4) % size;
+
+                    xs[i] = normals[y*size+x].x();
+                    ys[i] = normals[y*size+x].y();
+                }
+
+                encodeChannel( xs, dst );
+                encodeChannel( ys, dst+8 );
+                dst += 16;
+            }
+        }
+
+        return dst;
+    }
+}
+
+unsigned int NormalMaps::getEncodedSize( unsigned int size )
+{
+    unsigned int bytes = 0;
+
+    for (unsigned int s = size; s > 0; s /= 2)
+        bytes += numBlocks(s) * numBlocks(s) * 16;
+
+    return bytes;
+}
+
+void NormalMaps::encode( const osg::Vec3f* normals, unsigned int size, unsigned int rowLength, unsigned char* dst )
+{
+    std::vector<osg::Vec3f> level( size*size );
+
+    for (unsigned int y = 0; y < size; ++y)
+    {
+        for (unsigned int x = 0; x < size; ++x)
+            level[y*size+x] = normals[y*rowLength+x];
+    }
+
+    for (unsigned int s = size; s > 0; s /= 2)
+    {
+        dst = encodeLevel( &level.front(), s, dst );
+
+        // Reduced in place, every normal is written after the four it is made of were read.
+        const unsigned int half = s/2;
+
+        for (unsigned int y = 0; y < half; ++y)
+        {
+            for (unsigned int x = 0; x < half; ++x)
+            {
+                osg::Vec3f n = level[ (2*y  )*s + 2*x ] + level[ (2*y  )*s + 2*x+1 ]
+                             + level[ (2*y+1)*s + 2*x ] + level[ (2*y+1)*s + 2*x+1 ];
+                n.normalize();
+
+                level[ y*half + x ] = n;
+            }
+        }
+    }
+}
+
+void NormalMaps::setImage( osg::Image* img, unsigned int size, unsigned char* data, osg::Image::AllocationMode mode )
+{
+    img->setImage( size, size, 1, FORMAT, FORMAT, GL_UNSIGNED_BYTE, data, mode, 1 );
+
+    // offsets of levels 1 and up
+    osg::Image::MipmapDataType offsets;
+    unsigned int offset = 0;
+
+    for (unsigned int s = size; s > 1; s /= 2)
+    {
+        offset += numBlocks(s) * numBlocks(s) * 16;
+        offsets.push_back( offset );
+    }
+
+    img->setMipmapLevels( offsets );
+}
+
+osg::Image* NormalMaps::createImage( unsigned int size )
+{
+    osg::Image* img = new osg::Image;
+
+    setImage( img, size, new unsigned char[ getEncodedSize(size) ], osg::Image::USE_NEW_DELETE );
+
+    return img;
+}
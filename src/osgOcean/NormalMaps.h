@@ -0,0 +1,57 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to osgOcean. Encodes normal maps as two channel block compressed
+// textures (signed RGTC2, also known as BC5) with a mip chain built on the
+// CPU, so that neither the upload nor the driver has to generate mipmaps.
+// Only x and y are stored, the shaders rebuild z = sqrt(1 - x^2 - y^2).
+
+#pragma once
+
+#include <osg/Image>
+#include <osg/Vec3f>
+#include <osg/Math>
+
+#ifndef GL_COMPRESSED_SIGNED_RED_GREEN_RGTC2_EXT
+  #define GL_COMPRESSED_SIGNED_RED_GREEN_RGTC2_EXT 0x8DBE
+#endif
+
+namespace osgOcean
+{
+    namespace NormalMaps
+    {
+        /** Pixel and internal format of the encoded maps. */
+        const GLenum FORMAT = GL_COMPRESSED_SIGNED_RED_GREEN_RGTC2_EXT;
+
+        /** @return the bytes of an encoded size*size map and its mip chain down to 1x1. */
+        unsigned int getEncodedSize( unsigned int size );
+
+        /**
+        * Encodes a repeating size*size map of unit normals into dst, which holds
+        * getEncodedSize(size) bytes. rowLength is the number of normals from one 
+        * row to the next. Each mipmap level is the renormalised average of 2x2 
+        * normals of the level above. size must be a power of two.
+        */
+        void encode( const osg::Vec3f* normals, unsigned int size, unsigned int rowLength, unsigned char* dst );
+
+        /** Points img at an encoded size*size map and sets up its mip chain. */
+        void setImage( osg::Image* img, unsigned int size, unsigned char* data, osg::Image::AllocationMode mode );
+
+        /** @return an image holding an encoded size*size map, for encode() to fill in. */
+        osg::Image* createImage( unsigned int size );
+    }
+}
@@ -42,6 +42,18 @@ float OceanTechnique::getSurfaceHeight(void) const
     return 0.f;
 }
 
+void OceanTechnique::getSurfaceHeightsAt(const float* xs, const float* ys, size_t n, float* heights, osg::Vec3f* normals,
+                                         osg::Vec3f* velocities, osg::Vec3f* accelerations)
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        heights[i] = getSurfaceHeightAt(xs[i], ys[i], normals ? normals+i : NULL);
+
+        if (velocities)    velocities[i].set(0.f, 0.f, 0.f);
+        if (accelerations) accelerations[i].set(0.f, 0.f, 0.f);
+    }
+}
+
 float OceanTechnique::getMaximumHeight(void) const
 {
     osg::notify(osg::DEBUG_INFO) << "OceanTechnique::getMaximumHeight() Not Implemented" << std::endl;
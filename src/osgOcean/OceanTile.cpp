@@ -17,6 +17,11 @@
 #include <stdlib.h> // Need to include this for linux compatibility not sure why.
 #include <osgOcean/OceanTile>
 
+#include "MipmapKernels.h"
+#include "NormalMaps.h"
+
+#include <vector>
+
 #ifdef DEBUG_DATA
 #include <osgDB/WriteFile>
 #include <fstream>
@@ -25,10 +30,31 @@
 
 using namespace osgOcean;
 
+namespace
+{
+    /** Fastest mipmap reduction kernel for this CPU. */
+    Mipmap::ReduceFunc getReduceKernel( void )
+    {
+#ifdef OSGOCEAN_AVX2
+        if (SIMD::cpuSupportsAVX2())
+            return &Mipmap::reduceAVX2;
+#endif
+#ifdef OSGOCEAN_SIMD_SSE2
+        return &Mipmap::reduce<SIMD::SSEFloat>;
+#else
+        return &Mipmap::reduce< SIMD::ScalarVec<float> >;
+#endif
+    }
+
+    const Mipmap::ReduceFunc reduceKernel = getReduceKernel();
+}
+
 OceanTile::OceanTile( void )
     :_resolution   (0)
     ,_rowLength    (0)
     ,_numVertices  (0)
+    ,_packedVertices(NULL)
+    ,_packedNormals(NULL)
     ,_spacing      (0)
     ,_maxDelta     (0)
     ,_averageHeight(0)
@@ -39,13 +65,16 @@ OceanTile::OceanTile( osg::FloatArray* heights,
                       unsigned int resolution, 
                       const float spacing, 
                       osg::Vec2Array* displacements,
-                      bool useVBO)
+                      bool useVBO,
+                      osg::Vec3Array* normals )
     
     :_resolution ( resolution )
     ,_rowLength  ( _resolution + 1 )
     ,_numVertices( _rowLength*_rowLength )
     ,_vertices   ( new osg::Vec3Array )
     ,_normals    ( new osg::Vec3Array(_numVertices) )
+    ,_packedVertices( NULL )
+    ,_packedNormals( NULL )
     ,_spacing    ( spacing )
     ,_maxDelta   ( 0.f )
     ,_useVBO     ( useVBO )
@@ -94,6 +123,9 @@ OceanTile::OceanTile( osg::FloatArray* heights,
 
             v.z() = heights->at( ptr );
 
+            if (normals)
+                (*_normals)[ array_pos(x,y,_rowLength) ] = normals->at( ptr );
+
 #ifdef DEBUG_DATA
             outFile << v.x() << std::endl;
             outFile << v.y() << std::endl;
@@ -113,8 +145,78 @@ OceanTile::OceanTile( osg::FloatArray* heights,
     _averageHeight = sumHeights / (float)_vertices->size();
     _maxHeight = maxHeight;
 
-    computeNormals();
-    //computeMaxDelta();
+    if (!normals)
+        computeNormals();
+}
+
+OceanTile::OceanTile( osg::Vec3Array* vertices, 
+                      osg::Vec3Array* normals,
+                      unsigned int resolution, 
+                      const float spacing,
+                      bool useVBO )
+    
+    :_resolution ( resolution )
+    ,_rowLength  ( _resolution + 1 )
+    ,_numVertices( _rowLength*_rowLength )
+    ,_vertices   ( vertices )
+    ,_normals    ( normals ? normals : new osg::Vec3Array(_numVertices) )
+    ,_packedVertices( NULL )
+    ,_packedNormals( NULL )
+    ,_spacing    ( spacing )
+    ,_maxDelta   ( 0.f )
+    ,_useVBO     ( useVBO )
+{
+    float sumHeights = 0.f;
+    float maxHeight = -FLT_MAX;
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+    {
+        const float z = (*_vertices)[i].z();
+
+        sumHeights += z;
+        maxHeight = osg::maximum(maxHeight, z);
+    }
+
+    _averageHeight = sumHeights / (float)_numVertices;
+    _maxHeight = maxHeight;
+
+    if (!normals)
+        computeNormals();
+}
+
+OceanTile::OceanTile( const unsigned char* packed,
+                      osg::Referenced* store,
+                      unsigned int resolution, 
+                      const float spacing,
+                      bool useVBO,
+                      const osg::Vec3f& packOffset,
+                      const osg::Vec3f& packScale )
+
+    :_resolution ( resolution )
+    ,_rowLength  ( _resolution + 1 )
+    ,_numVertices( _rowLength*_rowLength )
+    ,_packedStore( store )
+    ,_packedVertices( reinterpret_cast<const unsigned short*>(packed) )
+    ,_packedNormals( packed + _numVertices*6 )
+    ,_packOffset ( packOffset )
+    ,_packScale  ( packScale )
+    ,_spacing    ( spacing )
+    ,_maxDelta   ( 0.f )
+    ,_useVBO     ( useVBO )
+{
+    float sumHeights = 0.f;
+    float maxHeight = -FLT_MAX;
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+    {
+        const float z = getVertex(i).z();
+
+        sumHeights += z;
+        maxHeight = osg::maximum(maxHeight, z);
+    }
+
+    _averageHeight = sumHeights / (float)_numVertices;
+    _maxHeight = maxHeight;
 }
 
 OceanTile::OceanTile( const OceanTile& tile, 
@@ -125,6 +227,8 @@ OceanTile::OceanTile( const OceanTile& tile,
     ,_numVertices( _rowLength*_rowLength )
     ,_vertices   ( new osg::Vec3Array(_numVertices) )
     ,_normals    ( new osg::Vec3Array(_numVertices) )
+    ,_packedVertices( NULL )
+    ,_packedNormals( NULL )
     ,_spacing    ( spacing )
     ,_maxDelta   ( 0.f )
     ,_useVBO     ( tile.getUseVBO() )
@@ -167,6 +271,11 @@ OceanTile::OceanTile( const OceanTile& tile,
 OceanTile::OceanTile( const OceanTile& copy )
     :_vertices       ( copy._vertices )
     ,_normals        ( copy._normals )
+    ,_packedStore    ( copy._packedStore )
+    ,_packedVertices ( copy._packedVertices )
+    ,_packedNormals  ( copy._packedNormals )
+    ,_packOffset     ( copy._packOffset )
+    ,_packScale      ( copy._packScale )
     ,_resolution     ( copy._resolution )
     ,_rowLength      ( copy._rowLength )
     ,_numVertices    ( copy._numVertices )
@@ -188,6 +297,11 @@ OceanTile& OceanTile::operator=(const OceanTile& rhs)
     {
         _vertices      = rhs._vertices;
         _normals       = rhs._normals;
+        _packedStore   = rhs._packedStore;
+        _packedVertices= rhs._packedVertices;
+        _packedNormals = rhs._packedNormals;
+        _packOffset    = rhs._packOffset;
+        _packScale     = rhs._packScale;
         _resolution    = rhs._resolution;
         _rowLength     = rhs._rowLength;
         _numVertices   = rhs._numVertices;
@@ -200,6 +314,221 @@ OceanTile& OceanTile::operator=(const OceanTile& rhs)
     return *this;
 }
 
+void OceanTile::buildMipmaps( OceanTile* levels, unsigned int numLevels )
+{
+    if (numLevels < 2)
+        return;
+
+    const OceanTile& top = levels[0];
+
+    for (unsigned int level = 1; level < numLevels; ++level)
+        levels[level].allocate( top._resolution >> level, top._spacing * float(1 << level), top._useVBO );
+
+    // pair sums of the widest row, see Mipmap::reduce()
+    std::vector<float> scratch( 6 * levels[1]._resolution );
+
+    for (unsigned int row = 0; row < levels[1]._resolution; ++row)
+    {
+        // An odd row completes a pair, which is reduced into the level below 
+        // right away rather than in another pass over the whole level.
+        unsigned int r = row;
+
+        for (unsigned int level = 1; level < numLevels; ++level)
+        {
+            levels[level].reduceRow( levels[level-1], r, &scratch.front() );
+
+            if (r % 2 == 0)
+                break;
+
+            r /= 2;
+        }
+    }
+
+    for (unsigned int level = 1; level < numLevels; ++level)
+        levels[level].completeMipmap();
+}
+
+void OceanTile::allocate( unsigned int resolution, float spacing, bool useVBO )
+{
+    _resolution     = resolution;
+    _rowLength      = resolution + 1;
+    _numVertices    = _rowLength*_rowLength;
+    _vertices       = new osg::Vec3Array( _numVertices );
+    _normals        = new osg::Vec3Array( _numVertices );
+    _packedStore    = NULL;
+    _packedVertices = NULL;
+    _packedNormals  = NULL;
+    _spacing        = spacing;
+    _maxDelta       = 0.f;
+    _averageHeight  = 0.f;
+    _maxHeight      = 0.f;
+    _useVBO         = useVBO;
+}
+
+void OceanTile::reduceRow( const OceanTile& parent, unsigned int row, float* scratch )
+{
+    const unsigned int parentRow = 2*row*parent._rowLength;
+
+    const float* vertices = (*parent._vertices)[0].ptr();
+    const float* normals  = (*parent._normals)[0].ptr();
+
+    osg::Vec3f* outVertices = &(*_vertices)[ row*_rowLength ];
+    osg::Vec3f* outNormals  = &(*_normals) [ row*_rowLength ];
+
+    reduceKernel( vertices + parentRow*3, vertices + (parentRow+parent._rowLength)*3, outVertices->ptr(), _resolution, scratch );
+    reduceKernel( normals  + parentRow*3, normals  + (parentRow+parent._rowLength)*3, outNormals->ptr(),  _resolution, scratch );
+
+    for (unsigned int i = 0; i < _resolution; ++i)
+        outNormals[i].normalize();
+}
+
+void OceanTile::completeMipmap( void )
+{
+    for( unsigned int i = 0; i < _rowLength-1; ++i )
+    {
+        // Copy top row into skirt
+        (*_vertices)[ array_pos( i, _rowLength-1, _rowLength) ] = (*_vertices)[ i ];
+        (*_normals) [ array_pos( i, _rowLength-1, _rowLength) ] = (*_normals) [ i ];
+
+        // Copy first column into skirt
+        (*_vertices)[ array_pos( _rowLength-1, i, _rowLength) ] = (*_vertices)[ i*_rowLength ];
+        (*_normals) [ array_pos( _rowLength-1, i, _rowLength) ] = (*_normals) [ i*_rowLength ];
+    }
+
+    // Copy corner value
+    (*_vertices)[ _numVertices-1 ] = (*_vertices)[0];
+    (*_normals) [ _numVertices-1 ] = (*_normals) [0];
+
+    float sumHeights = 0.f;
+    float maxHeight = -FLT_MAX;
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+    {
+        const float z = (*_vertices)[i].z();
+
+        sumHeights += z;
+        maxHeight = osg::maximum(maxHeight, z);
+    }
+
+    _averageHeight = sumHeights / (float)_numVertices;
+    _maxHeight = maxHeight;
+}
+
+void OceanTile::pack( void )
+{
+    if (isPacked() || !_vertices.valid())
+        return;
+
+    // Offsets from the grid are bounded by the wave amplitudes, so 16 bits 
+    // over the range of the tile resolve them to well under a millimetre.
+    osg::Vec3f minOffset(  FLT_MAX,  FLT_MAX,  FLT_MAX );
+    osg::Vec3f maxOffset( -FLT_MAX, -FLT_MAX, -FLT_MAX );
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+    {
+        const osg::Vec3f d = (*_vertices)[i] - getGridPosition(i);
+
+        for(unsigned int c = 0; c < 3; ++c )
+        {
+            minOffset[c] = osg::minimum( minOffset[c], d[c] );
+            maxOffset[c] = osg::maximum( maxOffset[c], d[c] );
+        }
+    }
+
+    _packOffset = minOffset;
+
+    osg::Vec3f invScale;
+
+    for(unsigned int c = 0; c < 3; ++c )
+    {
+        const float range = maxOffset[c] - minOffset[c];
+
+        _packScale[c] = range / 65535.f;
+        invScale[c]   = range > 0.f ? 65535.f / range : 0.f;
+    }
+
+    // one block, vertices first, so the data can be written out as is
+    osg::UByteArray* store = new osg::UByteArray( getPackedSize() );
+
+    unsigned short* vertices = reinterpret_cast<unsigned short*>( &store->front() );
+    unsigned char*  normals  = &store->front() + _numVertices*6;
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+    {
+        const osg::Vec3f d = (*_vertices)[i] - getGridPosition(i);
+
+        for(unsigned int c = 0; c < 3; ++c )
+        {
+            const float q = ( d[c] - minOffset[c] ) * invScale[c] + 0.5f;
+
+            vertices[i*3+c] = (unsigned short)osg::clampBetween( q, 0.f, 65535.f );
+        }
+
+        encodeNormal( (*_normals)[i], normals + i*2 );
+    }
+
+    _packedStore    = store;
+    _packedVertices = vertices;
+    _packedNormals  = normals;
+
+    _vertices = NULL;
+    _normals  = NULL;
+}
+
+void OceanTile::encodeNormal( const osg::Vec3f& n, unsigned char* packed )
+{
+    const float sum = fabsf(n.x()) + fabsf(n.y()) + fabsf(n.z());
+
+    if (sum <= 0.f)
+    {
+        packed[0] = packed[1] = 127;
+        return;
+    }
+
+    // project onto the octahedron |x|+|y|+|z| = 1, folding the lower half out
+    float x = n.x() / sum;
+    float y = n.y() / sum;
+
+    if (n.z() < 0.f)
+    {
+        const float fx = ( 1.f - fabsf(y) ) * ( x >= 0.f ? 1.f : -1.f );
+        const float fy = ( 1.f - fabsf(x) ) * ( y >= 0.f ? 1.f : -1.f );
+        x = fx;
+        y = fy;
+    }
+
+    packed[0] = (unsigned char)( floorf( x*127.f + 0.5f ) + 127.f );
+    packed[1] = (unsigned char)( floorf( y*127.f + 0.5f ) + 127.f );
+}
+
+void OceanTile::copyVertices( osg::Vec3Array& vertices ) const
+{
+    if (!isPacked())
+    {
+        vertices = *_vertices;
+        return;
+    }
+
+    vertices.resize( _numVertices );
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+        vertices[i] = getVertex(i);
+}
+
+void OceanTile::copyNormals( osg::Vec3Array& normals ) const
+{
+    if (!isPacked())
+    {
+        normals = *_normals;
+        return;
+    }
+
+    normals.resize( _numVertices );
+
+    for(unsigned int i = 0; i < _numVertices; ++i )
+        normals[i] = decodeNormal( _packedNormals + i*2 );
+}
+
 void OceanTile::computeNormals( void )
 {
     int x1,x2,y1,y2;
@@ -296,50 +625,55 @@ void OceanTile::computeNormals( void )
     }
 }
 
-void OceanTile::computeMaxDelta( void )
+void OceanTile::computeMaxDelta( const OceanTile& full )
 {
-    float deltaMax = 0;
+    _maxDelta = full.computeDelta( *this, 1, full._resolution / _resolution );
+}
+
+float OceanTile::computeSubsampledDelta( unsigned int step ) const
+{
+    return computeDelta( *this, step, step );
+}
+
+float OceanTile::computeDelta( const OceanTile& coarse, unsigned int stride, unsigned int step ) const
+{
+    if (step <= 1)
+        return 0.f;
 
-    int step = 2;
-    int numLevels = 6;
+    // The cell corners are loaded once and the step x step vertices they cover
+    // compared against them, the last corner row and column lie on the skirt.
+    const unsigned int numCells = _resolution / step;
+    const float invStep = 1.f / (float)step;
 
-    for (int level=1; level < numLevels; ++level)
+    float deltaMax = 0.f;
+
+    for (unsigned int cy = 0; cy < numCells; ++cy)
     {
-        for( unsigned int i=0; i < _resolution; ++i) 
+        for (unsigned int cx = 0; cx < numCells; ++cx)
         {
-            int posY = i/step * step;
-            
-            for( unsigned int j=0; j < _resolution; ++j) 
+            const float s00 = coarse.getVertex( cx   *stride,  cy   *stride ).z();
+            const float s01 = coarse.getVertex((cx+1)*stride,  cy   *stride ).z();
+            const float s10 = coarse.getVertex( cx   *stride, (cy+1)*stride ).z();
+            const float s11 = coarse.getVertex((cx+1)*stride, (cy+1)*stride ).z();
+
+            for (unsigned int ty = 0; ty < step; ++ty)
             {
-                if (i%step != 0 || j%step != 0) 
+                const float dy = (float)ty * invStep;
+                const float v0 = s00 + (s10 - s00)*dy;
+                const float v1 = s01 + (s11 - s01)*dy;
+
+                for (unsigned int tx = 0; tx < step; ++tx)
                 {
-                    int posX = j/step * step;
+                    const float h = v0 + (v1 - v0)*(float)tx*invStep;
+                    const float delta = fabs( h - getVertex( cx*step+tx, cy*step+ty ).z() );
 
-                    float delta = biLinearInterp(posX, posX+step, posY, posY+step, j, i);
-                    delta -= getVertex(j, i).z();
-                    delta = fabs(delta);
-                    deltaMax = std::max(deltaMax, delta);
+                    deltaMax = osg::maximum( deltaMax, delta );
                 }
             }
         }
-        step *= 2;
     }
-}
 
-float OceanTile::biLinearInterp(int lx, int hx, int ly, int hy, int tx, int ty ) const
-{
-    float s00 = getVertex(lx, ly).z();
-    float s01 = getVertex(hx, ly).z();
-    float s10 = getVertex(lx, hy).z();
-    float s11 = getVertex(hx, hy).z();
-
-    int dx = hx - lx;
-    int dtx = tx - lx;
-    float v0 = (s01 - s00)/dx*dtx + s00;
-    float v1 = (s11 - s10)/dx*dtx + s10;
-    float value = (v1 - v0)/(hy - ly)*(ty - ly) + v0;
-
-    return value;
+    return deltaMax;
 }
 
 float OceanTile::biLinearInterp(float x, float y ) const
@@ -392,35 +726,41 @@ osg::ref_ptr<osg::Texture2D> OceanTile::createNormalMap( void )
 {
     osg::ref_ptr<osg::Texture2D> texture = new osg::Texture2D;
 
-    unsigned char* pixels = new unsigned char[_resolution*_resolution*3];    
+    std::vector<osg::Vec3f> normals( _resolution*_resolution );
 
-    unsigned int idx = 0;
     unsigned int i = 0;
 
     for(unsigned int r = 0; r < _resolution; ++r )
     {
         for(unsigned int c = 0; c < _resolution; ++c )
         {
-            idx = i*3;
-            osg::Vec3f n = getNormal(c,r);
-
-            pixels[idx]   = (unsigned char)(127.f * n.x() + 128.f);
-            pixels[idx+1] = (unsigned char)(127.f * n.y() + 128.f);
-            pixels[idx+2] = (unsigned char)(127.f * n.z() + 128.f);
-
+            normals[i] = getNormal(c,r);
             i++;
         }
     }
 
-    osg::Image* img = new osg::Image;
-    img->setImage(_resolution, _resolution, 1, GL_RGB, GL_RGB, GL_UNSIGNED_BYTE, pixels, osg::Image::USE_NEW_DELETE, 1);
+    // compressed with its mip chain, nothing is generated at upload
+    osg::Image* img = NormalMaps::createImage( _resolution );
+    NormalMaps::encode( &normals.front(), _resolution, _resolution, img->data() );
 
 #ifdef DEBUG_DATA
     // saves normal map as image
+    unsigned char* pixels = new unsigned char[_resolution*_resolution*3];    
+
+    for( i = 0; i < normals.size(); ++i )
+    {
+        pixels[i*3]   = (unsigned char)(127.f * normals[i].x() + 128.f);
+        pixels[i*3+1] = (unsigned char)(127.f * normals[i].y() + 128.f);
+        pixels[i*3+2] = (unsigned char)(127.f * normals[i].z() + 128.f);
+    }
+
+    osg::ref_ptr<osg::Image> debugImg = new osg::Image;
+    debugImg->setImage(_resolution, _resolution, 1, GL_RGB, GL_RGB, GL_UNSIGNED_BYTE, pixels, osg::Image::USE_NEW_DELETE, 1);
+
     static int count = 0;
     std::stringstream ss;
     ss << "Tile_" << count << ".bmp";
-    osgDB::writeImageFile( *img, ss.str() );
+    osgDB::writeImageFile( *debugImg, ss.str() );
     ++count;
 #endif
 
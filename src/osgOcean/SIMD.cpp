@@ -0,0 +1,50 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+#include "SIMD.h"
+
+#if defined(OSGOCEAN_AVX2) && defined(_MSC_VER)
+  #include <intrin.h>
+#endif
+
+bool osgOcean::SIMD::cpuSupportsAVX2( void )
+{
+#if !defined(OSGOCEAN_AVX2)
+    return false;
+#elif defined(_MSC_VER)
+    int info[4];
+
+    __cpuid( info, 0 );
+    if (info[0] < 7)
+        return false;
+
+    // AVX instructions and OS support for saving the YMM registers
+    __cpuid( info, 1 );
+    if ( (info[2] & (1<<27)) == 0 || (info[2] & (1<<28)) == 0 )
+        return false;
+
+    if ( (_xgetbv(0) & 6) != 6 )
+        return false;
+
+    __cpuidex( info, 7, 0 );
+    return (info[1] & (1<<5)) != 0;
+#elif defined(__GNUC__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#else
+    return false;
+#endif
+}
@@ -0,0 +1,349 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to osgOcean. Thin wrappers around the SIMD instruction sets used
+// by the CPU kernels, so that each kernel is written once as a template and
+// instantiated for scalar, SSE2 and AVX2 code.
+//
+// SSE2 is part of the x86-64 baseline and is available wherever the
+// compiler targets it. The AVX2 wrappers are only visible in translation
+// units compiled with AVX2 enabled (the *AVX2.cpp files, see CMakeLists.txt);
+// their kernels must only be called once cpuSupportsAVX2() returned true.
+//
+// Every wrapper provides load/store/set1/add/sub/mul, a gather for table
+// lookups and storeComplex. The single precision ones also provide the
+// division and the integer, comparison and mask operations needed by
+// sincos() and the surface queries.
+
+#pragma once
+
+#include <complex>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+  #define OSGOCEAN_SIMD_SSE2
+  #include <emmintrin.h>
+#endif
+
+#if defined(__AVX2__)
+  #define OSGOCEAN_SIMD_AVX2
+  #include <immintrin.h>
+#endif
+
+namespace osgOcean
+{
+    namespace SIMD
+    {
+        /** @return true if the AVX2 kernels were built and the CPU and OS support them. */
+        bool cpuSupportsAVX2( void );
+
+    // The wrappers get internal linkage, and with them every kernel template
+    // instantiated on them. Otherwise the linker could pick an AVX2 compiled
+    // copy of a shared inline function for use in code that runs without AVX2.
+    // This does not extend to the inline functions of std or osg the kernels
+    // call, which is why the wrappers and kernels avoid them: e.g. complex 
+    // values are stored as pairs of reals and floor() is only called on doubles.
+    namespace
+    {
+
+        /** Scalar "vector" of width 1, used for the portable kernels. */
+        template<typename T>
+        struct ScalarVec
+        {
+            typedef T    real_type;
+            typedef T    type;
+            typedef int  itype;
+            typedef bool mask;
+            enum { width = 1 };
+
+            static inline type load ( const T* p )              { return *p; }
+            static inline void store( T* p, const type& v )     { *p = v; }
+            static inline type set1 ( T v )                     { return v; }
+            static inline type add  ( const type& a, const type& b ){ return a+b; }
+            static inline type sub  ( const type& a, const type& b ){ return a-b; }
+            static inline type mul  ( const type& a, const type& b ){ return a*b; }
+            static inline type div  ( const type& a, const type& b ){ return a/b; }
+
+            static inline itype roundToInt( const type& a )      { return (int)::floor( (double)(a+T(0.5)) ); }
+            static inline type  toReal    ( const itype& a )     { return (T)a; }
+            static inline mask  testBit   ( const itype& a, int bit ){ return (a & bit) != 0; }
+            static inline type  select    ( const mask& m, const type& a, const type& b ){ return m ? a : b; }
+            static inline type  negate    ( const mask& m, const type& a ){ return m ? -a : a; }
+            static inline type  gather    ( const T* base, const int* idx ){ return base[*idx]; }
+
+            // same operand order as minps/maxps, b is returned if either is NaN
+            static inline type  minimum   ( const type& a, const type& b ){ return a < b ? a : b; }
+            static inline type  maximum   ( const type& a, const type& b ){ return a > b ? a : b; }
+            static inline itype truncToInt( const type& a )      { return (int)a; }
+            static inline void  storeInt  ( int* p, const itype& a ){ *p = a; }
+            static inline mask  less      ( const type& a, const type& b ){ return a < b; }
+            static inline mask  lessEqual ( const type& a, const type& b ){ return a <= b; }
+            static inline mask  maskAnd   ( const mask& a, const mask& b ){ return a && b; }
+
+            static inline void storeComplex( std::complex<T>* p, const type& re, const type& im )
+            {
+                T* t = reinterpret_cast<T*>(p);
+                t[0] = re;
+                t[1] = im;
+            }
+        };
+
+#ifdef OSGOCEAN_SIMD_SSE2
+        struct SSEFloat
+        {
+            typedef float   real_type;
+            typedef __m128  type;
+            typedef __m128i itype;
+            typedef __m128  mask;
+            enum { width = 4 };
+
+            static inline type load ( const float* p )          { return _mm_loadu_ps(p); }
+            static inline void store( float* p, const type& v ) { _mm_storeu_ps(p,v); }
+            static inline type set1 ( float v )                 { return _mm_set1_ps(v); }
+            static inline type add  ( const type& a, const type& b ){ return _mm_add_ps(a,b); }
+            static inline type sub  ( const type& a, const type& b ){ return _mm_sub_ps(a,b); }
+            static inline type mul  ( const type& a, const type& b ){ return _mm_mul_ps(a,b); }
+            static inline type div  ( const type& a, const type& b ){ return _mm_div_ps(a,b); }
+
+            static inline itype roundToInt( const type& a )      { return _mm_cvtps_epi32(a); }
+            static inline type  toReal    ( const itype& a )     { return _mm_cvtepi32_ps(a); }
+
+            static inline mask testBit( const itype& a, int bit )
+            {
+                const __m128i b = _mm_set1_epi32(bit);
+                return _mm_castsi128_ps( _mm_cmpeq_epi32( _mm_and_si128(a,b), b ) );
+            }
+
+            static inline type select( const mask& m, const type& a, const type& b )
+            {
+                return _mm_or_ps( _mm_and_ps(m,a), _mm_andnot_ps(m,b) );
+            }
+
+            static inline type negate( const mask& m, const type& a )
+            {
+                return _mm_xor_ps( a, _mm_and_ps( m, _mm_set1_ps(-0.f) ) );
+            }
+
+            static inline type gather( const float* base, const int* idx )
+            {
+                return _mm_setr_ps( base[idx[0]], base[idx[1]], base[idx[2]], base[idx[3]] );
+            }
+
+            static inline type  minimum   ( const type& a, const type& b ){ return _mm_min_ps(a,b); }
+            static inline type  maximum   ( const type& a, const type& b ){ return _mm_max_ps(a,b); }
+            static inline itype truncToInt( const type& a )      { return _mm_cvttps_epi32(a); }
+            static inline void  storeInt  ( int* p, const itype& a ){ _mm_storeu_si128( reinterpret_cast<__m128i*>(p), a ); }
+            static inline mask  less      ( const type& a, const type& b ){ return _mm_cmplt_ps(a,b); }
+            static inline mask  lessEqual ( const type& a, const type& b ){ return _mm_cmple_ps(a,b); }
+            static inline mask  maskAnd   ( const mask& a, const mask& b ){ return _mm_and_ps(a,b); }
+
+            static inline void storeComplex( std::complex<float>* p, const type& re, const type& im )
+            {
+                float* f = reinterpret_cast<float*>(p);
+                _mm_storeu_ps( f,   _mm_unpacklo_ps(re,im) );
+                _mm_storeu_ps( f+4, _mm_unpackhi_ps(re,im) );
+            }
+        };
+
+        struct SSEDouble
+        {
+            typedef double  real_type;
+            typedef __m128d type;
+            enum { width = 2 };
+
+            static inline type load ( const double* p )          { return _mm_loadu_pd(p); }
+            static inline void store( double* p, const type& v ) { _mm_storeu_pd(p,v); }
+            static inline type set1 ( double v )                 { return _mm_set1_pd(v); }
+            static inline type add  ( const type& a, const type& b ){ return _mm_add_pd(a,b); }
+            static inline type sub  ( const type& a, const type& b ){ return _mm_sub_pd(a,b); }
+            static inline type mul  ( const type& a, const type& b ){ return _mm_mul_pd(a,b); }
+
+            static inline type gather( const double* base, const int* idx )
+            {
+                return _mm_setr_pd( base[idx[0]], base[idx[1]] );
+            }
+
+            static inline void storeComplex( std::complex<double>* p, const type& re, const type& im )
+            {
+                double* d = reinterpret_cast<double*>(p);
+                _mm_storeu_pd( d,   _mm_unpacklo_pd(re,im) );
+                _mm_storeu_pd( d+2, _mm_unpackhi_pd(re,im) );
+            }
+        };
+#endif
+
+#ifdef OSGOCEAN_SIMD_AVX2
+        struct AVXFloat
+        {
+            typedef float   real_type;
+            typedef __m256  type;
+            typedef __m256i itype;
+            typedef __m256  mask;
+            enum { width = 8 };
+
+            static inline type load ( const float* p )          { return _mm256_loadu_ps(p); }
+            static inline void store( float* p, const type& v ) { _mm256_storeu_ps(p,v); }
+            static inline type set1 ( float v )                 { return _mm256_set1_ps(v); }
+            static inline type add  ( const type& a, const type& b ){ return _mm256_add_ps(a,b); }
+            static inline type sub  ( const type& a, const type& b ){ return _mm256_sub_ps(a,b); }
+            static inline type mul  ( const type& a, const type& b ){ return _mm256_mul_ps(a,b); }
+            static inline type div  ( const type& a, const type& b ){ return _mm256_div_ps(a,b); }
+
+            static inline itype roundToInt( const type& a )      { return _mm256_cvtps_epi32(a); }
+            static inline type  toReal    ( const itype& a )     { return _mm256_cvtepi32_ps(a); }
+
+            static inline mask testBit( const itype& a, int bit )
+            {
+                const __m256i b = _mm256_set1_epi32(bit);
+                return _mm256_castsi256_ps( _mm256_cmpeq_epi32( _mm256_and_si256(a,b), b ) );
+            }
+
+            static inline type select( const mask& m, const type& a, const type& b )
+            {
+                return _mm256_blendv_ps(b,a,m);
+            }
+
+            static inline type negate( const mask& m, const type& a )
+            {
+                return _mm256_xor_ps( a, _mm256_and_ps( m, _mm256_set1_ps(-0.f) ) );
+            }
+
+            static inline type gather( const float* base, const int* idx )
+            {
+                return _mm256_i32gather_ps( base, _mm256_loadu_si256( reinterpret_cast<const __m256i*>(idx) ), 4 );
+            }
+
+            static inline type  minimum   ( const type& a, const type& b ){ return _mm256_min_ps(a,b); }
+            static inline type  maximum   ( const type& a, const type& b ){ return _mm256_max_ps(a,b); }
+            static inline itype truncToInt( const type& a )      { return _mm256_cvttps_epi32(a); }
+            static inline void  storeInt  ( int* p, const itype& a ){ _mm256_storeu_si256( reinterpret_cast<__m256i*>(p), a ); }
+            static inline mask  less      ( const type& a, const type& b ){ return _mm256_cmp_ps(a,b,_CMP_LT_OQ); }
+            static inline mask  lessEqual ( const type& a, const type& b ){ return _mm256_cmp_ps(a,b,_CMP_LE_OQ); }
+            static inline mask  maskAnd   ( const mask& a, const mask& b ){ return _mm256_and_ps(a,b); }
+
+            static inline void storeComplex( std::complex<float>* p, const type& re, const type& im )
+            {
+                // unpack works within 128 bit lanes, swap the middle halves back
+                const __m256 lo = _mm256_unpacklo_ps(re,im);
+                const __m256 hi = _mm256_unpackhi_ps(re,im);
+
+                float* f = reinterpret_cast<float*>(p);
+                _mm256_storeu_ps( f,   _mm256_permute2f128_ps(lo,hi,0x20) );
+                _mm256_storeu_ps( f+8, _mm256_permute2f128_ps(lo,hi,0x31) );
+            }
+        };
+
+        struct AVXDouble
+        {
+            typedef double  real_type;
+            typedef __m256d type;
+            enum { width = 4 };
+
+            static inline type load ( const double* p )          { return _mm256_loadu_pd(p); }
+            static inline void store( double* p, const type& v ) { _mm256_storeu_pd(p,v); }
+            static inline type set1 ( double v )                 { return _mm256_set1_pd(v); }
+            static inline type add  ( const type& a, const type& b ){ return _mm256_add_pd(a,b); }
+            static inline type sub  ( const type& a, const type& b ){ return _mm256_sub_pd(a,b); }
+            static inline type mul  ( const type& a, const type& b ){ return _mm256_mul_pd(a,b); }
+
+            static inline type gather( const double* base, const int* idx )
+            {
+                return _mm256_i32gather_pd( base, _mm_loadu_si128( reinterpret_cast<const __m128i*>(idx) ), 8 );
+            }
+
+            static inline void storeComplex( std::complex<double>* p, const type& re, const type& im )
+            {
+                const __m256d lo = _mm256_unpacklo_pd(re,im);
+                const __m256d hi = _mm256_unpackhi_pd(re,im);
+
+                double* d = reinterpret_cast<double*>(p);
+                _mm256_storeu_pd( d,   _mm256_permute2f128_pd(lo,hi,0x20) );
+                _mm256_storeu_pd( d+4, _mm256_permute2f128_pd(lo,hi,0x31) );
+            }
+        };
+#endif
+
+        /**
+        * Sine and cosine of a vector of angles. Cody-Waite reduction to
+        * [-PI/4,PI/4] followed by the Cephes single precision polynomials.
+        * Accurate to a few ulp for |x| < 8192.
+        */
+        template<class V>
+        inline void sincos( const typename V::type& x, typename V::type& s, typename V::type& c )
+        {
+            typedef typename V::type vec;
+
+            const typename V::itype j = V::roundToInt( V::mul( x, V::set1(0.63661977236758134f) ) );   // x * 2/PI
+            const vec fj = V::toReal(j);
+
+            // x - j*PI/2 in three parts to keep the reduction exact
+            vec r = V::sub( x, V::mul( fj, V::set1(1.5703125f) ) );
+            r = V::sub( r, V::mul( fj, V::set1(4.837512969970703125e-4f) ) );
+            r = V::sub( r, V::mul( fj, V::set1(7.54978995489188216e-8f) ) );
+
+            const vec z = V::mul(r,r);
+
+            vec ps = V::add( V::mul( z, V::set1(-1.9515295891e-4f) ), V::set1(8.3321608736e-3f) );
+            ps = V::add( V::mul( ps, z ), V::set1(-1.6666654611e-1f) );
+            ps = V::add( V::mul( V::mul( ps, z ), r ), r );
+
+            vec pc = V::add( V::mul( z, V::set1(2.443315711809948e-5f) ), V::set1(-1.388731625493765e-3f) );
+            pc = V::add( V::mul( pc, z ), V::set1(4.166664568298827e-2f) );
+            pc = V::add( V::sub( V::mul( V::mul( pc, z ), z ), V::mul( z, V::set1(0.5f) ) ), V::set1(1.f) );
+
+            // quadrant j: (s,c) = (ps,pc), (pc,-ps), (-ps,-pc), (-pc,ps)
+            const typename V::mask swap = V::testBit( j, 1 );
+
+            s = V::negate( V::testBit( j, 2 ), V::select( swap, pc, ps ) );
+            c = V::negate( V::testBit( V::roundToInt( V::add( fj, V::set1(1.f) ) ), 2 ), V::select( swap, ps, pc ) );
+        }
+
+        // The polynomials above are only accurate to single precision, double
+        // precision code evaluates the library functions lane by lane.
+        template<>
+        inline void sincos< ScalarVec<double> >( const double& x, double& s, double& c )
+        {
+            s = sin(x);
+            c = cos(x);
+        }
+
+#ifdef OSGOCEAN_SIMD_SSE2
+        template<>
+        inline void sincos<SSEDouble>( const __m128d& x, __m128d& s, __m128d& c )
+        {
+            double a[2];
+            _mm_storeu_pd( a, x );
+
+            s = _mm_setr_pd( sin(a[0]), sin(a[1]) );
+            c = _mm_setr_pd( cos(a[0]), cos(a[1]) );
+        }
+#endif
+
+#ifdef OSGOCEAN_SIMD_AVX2
+        template<>
+        inline void sincos<AVXDouble>( const __m256d& x, __m256d& s, __m256d& c )
+        {
+            double a[4];
+            _mm256_storeu_pd( a, x );
+
+            s = _mm256_setr_pd( sin(a[0]), sin(a[1]), sin(a[2]), sin(a[3]) );
+            c = _mm256_setr_pd( cos(a[0]), cos(a[1]), cos(a[2]), cos(a[3]) );
+        }
+#endif
+    }   // anonymous namespace
+    }
+}
@@ -0,0 +1,224 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to FFTSimulation. Evolves the fourier amplitudes to the current
+// time and writes the FFT inputs of every requested field in one pass.
+// Instantiated for scalar and SSE2 code in FFTSimulation.cpp and for AVX2
+// in FFTSimulationAVX2.cpp, in single and double precision.
+
+#pragma once
+#include "SIMD.h"
+
+#include <complex>
+
+namespace osgOcean
+{
+    namespace Spectrum
+    {
+        /**
+        * Time independent terms of h(k,t) = h0(k)e^(iwt) + conj(h0(-k))e^(-iwt),
+        * stored as separate arrays so that they can be loaded straight into
+        * vector registers. With H = h0(k) and C = conj(h0(-k)):
+        * Re(h) = (Re(H)+Re(C))cos(wt) + (Im(C)-Im(H))sin(wt)
+        * Im(h) = (Im(H)+Im(C))cos(wt) + (Re(H)-Re(C))sin(wt)
+        */
+        template<typename T>
+        struct Coefficients
+        {
+            const T*   reCos;       /**< Re(H)+Re(C) */
+            const T*   reSin;       /**< Im(C)-Im(H) */
+            const T*   imCos;       /**< Im(H)+Im(C) */
+            const T*   imSin;       /**< Re(H)-Re(C) */
+            const T*   w;           /**< Angular frequency */
+            const int* multiple;    /**< Angular frequency as a multiple of the base frequency w0 */
+            const T*   khX;         /**< Normalised wave vector */
+            const T*   khY;
+            const T*   kX;          /**< Wave vector */
+            const T*   kY;
+        };
+
+        /**
+        * Phase of the current time. Since every frequency is a whole multiple
+        * m of w0, cos(wt) and sin(wt) can be looked up in tables of cos(m*w0*t)
+        * and sin(m*w0*t) instead of being evaluated per sample. Without tables
+        * the kernels evaluate them from Coefficients::w and time.
+        */
+        template<typename T>
+        struct Phase
+        {
+            T time;
+            const T* cosTable;      /**< Indexed by Coefficients::multiple, may be NULL */
+            const T* sinTable;
+        };
+
+        /** Order of the output arrays passed to the kernels. */
+        enum Output
+        {
+            HEIGHT = 0,
+            DISPLACEMENT_X,
+            DISPLACEMENT_Y,
+            SLOPE_X,
+            SLOPE_Y,
+            DISPLACEMENT_XX,    /**< d(Dx)/dx */
+            DISPLACEMENT_YY,    /**< d(Dy)/dy */
+            DISPLACEMENT_XY,    /**< d(Dx)/dy == d(Dy)/dx */
+            VELOCITY_Z,         /**< dh/dt */
+            VELOCITY_X,         /**< d(Dx)/dt */
+            VELOCITY_Y,         /**< d(Dy)/dt */
+            ACCELERATION_Z,     /**< d2h/dt2 */
+            ACCELERATION_X,     /**< d2(Dx)/dt2 */
+            ACCELERATION_Y,     /**< d2(Dy)/dt2 */
+            NUM_OUTPUTS
+        };
+
+        /**
+        * Writes the spectra of h, -i*Kh*h, i*K*h and the derivatives of the
+        * displacements Kh*K*h at the given time for samples [0,count), and the
+        * time derivatives of h and -i*Kh*h. Outputs that are NULL are skipped, 
+        * the components of displacements, slopes, displacement derivatives and
+        * the horizontal velocities and accelerations are written as groups, the
+        * latter only along with the vertical ones.
+        */
+        template<typename T>
+        struct Evolve
+        {
+            typedef void (*Func)( const Coefficients<T>& coeffs, int count, const Phase<T>& phase, std::complex<T>* const* outputs );
+        };
+
+        template<class V>
+        inline void evolveStep( const Coefficients<typename V::real_type>& k, 
+                                int i, 
+                                const Phase<typename V::real_type>& phase, 
+                                std::complex<typename V::real_type>* const* out )
+        {
+            typedef typename V::type vec;
+
+            vec s, c;
+
+            if (phase.cosTable)
+            {
+                c = V::gather( phase.cosTable, k.multiple+i );
+                s = V::gather( phase.sinTable, k.multiple+i );
+            }
+            else
+            {
+                SIMD::sincos<V>( V::mul( V::load(k.w+i), V::set1(phase.time) ), s, c );
+            }
+
+            const vec re = V::add( V::mul( V::load(k.reCos+i), c ), V::mul( V::load(k.reSin+i), s ) );
+            const vec im = V::add( V::mul( V::load(k.imCos+i), c ), V::mul( V::load(k.imSin+i), s ) );
+            const vec zero = V::set1(0.f);
+
+            if (out[HEIGHT])
+                V::storeComplex( out[HEIGHT]+i, re, im );
+
+            if (out[DISPLACEMENT_X])  // -i * Kh * h
+            {
+                const vec khX = V::load(k.khX+i);
+                const vec khY = V::load(k.khY+i);
+
+                V::storeComplex( out[DISPLACEMENT_X]+i, V::mul(im,khX), V::sub( zero, V::mul(re,khX) ) );
+                V::storeComplex( out[DISPLACEMENT_Y]+i, V::mul(im,khY), V::sub( zero, V::mul(re,khY) ) );
+            }
+
+            if (out[SLOPE_X])         // i * K * h
+            {
+                const vec kX = V::load(k.kX+i);
+                const vec kY = V::load(k.kY+i);
+
+                V::storeComplex( out[SLOPE_X]+i, V::sub( zero, V::mul(im,kX) ), V::mul(re,kX) );
+                V::storeComplex( out[SLOPE_Y]+i, V::sub( zero, V::mul(im,kY) ), V::mul(re,kY) );
+            }
+
+            if (out[DISPLACEMENT_XX]) // i * K * -i * Kh * h
+            {
+                const vec khX = V::load(k.khX+i);
+                const vec kX  = V::load(k.kX+i);
+                const vec kY  = V::load(k.kY+i);
+
+                const vec xx = V::mul( khX, kX );
+                const vec yy = V::mul( V::load(k.khY+i), kY );
+                const vec xy = V::mul( khX, kY );
+
+                V::storeComplex( out[DISPLACEMENT_XX]+i, V::mul(re,xx), V::mul(im,xx) );
+                V::storeComplex( out[DISPLACEMENT_YY]+i, V::mul(re,yy), V::mul(im,yy) );
+                V::storeComplex( out[DISPLACEMENT_XY]+i, V::mul(re,xy), V::mul(im,xy) );
+            }
+
+            if (out[VELOCITY_Z] || out[ACCELERATION_Z])
+            {
+                const vec w = V::load(k.w+i);
+
+                if (out[VELOCITY_Z])  // d/dt of cos(wt) and sin(wt) is w*(-sin(wt), cos(wt))
+                {
+                    const vec vre = V::mul( w, V::sub( V::mul( V::load(k.reSin+i), c ), V::mul( V::load(k.reCos+i), s ) ) );
+                    const vec vim = V::mul( w, V::sub( V::mul( V::load(k.imSin+i), c ), V::mul( V::load(k.imCos+i), s ) ) );
+
+                    V::storeComplex( out[VELOCITY_Z]+i, vre, vim );
+
+                    if (out[VELOCITY_X])
+                    {
+                        const vec khX = V::load(k.khX+i);
+                        const vec khY = V::load(k.khY+i);
+
+                        V::storeComplex( out[VELOCITY_X]+i, V::mul(vim,khX), V::sub( zero, V::mul(vre,khX) ) );
+                        V::storeComplex( out[VELOCITY_Y]+i, V::mul(vim,khY), V::sub( zero, V::mul(vre,khY) ) );
+                    }
+                }
+
+                if (out[ACCELERATION_Z])  // -w^2 * h
+                {
+                    const vec w2  = V::sub( zero, V::mul(w,w) );
+                    const vec are = V::mul(re,w2);
+                    const vec aim = V::mul(im,w2);
+
+                    V::storeComplex( out[ACCELERATION_Z]+i, are, aim );
+
+                    if (out[ACCELERATION_X])
+                    {
+                        const vec khX = V::load(k.khX+i);
+                        const vec khY = V::load(k.khY+i);
+
+                        V::storeComplex( out[ACCELERATION_X]+i, V::mul(aim,khX), V::sub( zero, V::mul(are,khX) ) );
+                        V::storeComplex( out[ACCELERATION_Y]+i, V::mul(aim,khY), V::sub( zero, V::mul(are,khY) ) );
+                    }
+                }
+            }
+        }
+
+        template<class V>
+        void evolve( const Coefficients<typename V::real_type>& coeffs, 
+                     int count, 
+                     const Phase<typename V::real_type>& phase, 
+                     std::complex<typename V::real_type>* const* outputs )
+        {
+            typedef typename V::real_type T;
+
+            int i = 0;
+
+            for (; i+V::width <= count; i += V::width)
+                evolveStep<V>( coeffs, i, phase, outputs );
+
+            for (; i < count; ++i)
+                evolveStep< SIMD::ScalarVec<T> >( coeffs, i, phase, outputs );
+        }
+
+        /** AVX2 instantiations, defined in FFTSimulationAVX2.cpp. */
+        void evolveAVX2( const Coefficients<float>& coeffs, int count, const Phase<float>& phase, std::complex<float>* const* outputs );
+        void evolveAVX2( const Coefficients<double>& coeffs, int count, const Phase<double>& phase, std::complex<double>* const* outputs );
+    }
+}
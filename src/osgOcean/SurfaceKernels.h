@@ -0,0 +1,320 @@
+/*
+* This source file is part of the osgOcean library
+* 
+* Copyright (C) 2009 Kim Bale
+* Copyright (C) 2009 The University of Hull, UK
+* 
+* This program is free software; you can redistribute it and/or modify it under
+* the terms of the GNU Lesser General Public License as published by the Free Software
+* Foundation; either version 3 of the License, or (at your option) any later
+* version.
+
+* This program is distributed in the hope that it will be useful, but WITHOUT
+* ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+* FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more details.
+* http://www.gnu.org/copyleft/lesser.txt.
+*/
+
+// Private to FFTOceanTechnique. Batched bilinear lookups of the surface
+// height, normal and motion, the vector version of FFTOceanSurface::getSurfaceHeightAt().
+// Instantiated for scalar and SSE2 code in FFTOceanTechnique.cpp and for
+// AVX2 in FFTOceanTechniqueAVX2.cpp.
+//
+// With choppy waves the sample at grid position p is drawn at p + D(p), so
+// the lookup first solves p + D(p) = q for the query position q with a fixed
+// number of Newton iterations. The Jacobian comes from the same bilinear cell
+// that D is interpolated from, so an iteration costs one extra set of gathers.
+
+#pragma once
+#include "SIMD.h"
+
+namespace osgOcean
+{
+    namespace Surface
+    {
+        /** Maps local coordinates onto the samples of the tile repeated over the surface. */
+        struct Lattice
+        {
+            float originX;          /**< Start position of the surface */
+            float originY;
+            float tileSize;         /**< Size of a tile in world units */
+            float tileSizeInv;
+            float extent;           /**< Size of the surface, tileSize * number of tiles */
+            float spacing;          /**< Distance between samples */
+            float spacingInv;
+            int   resolution;       /**< Samples per tile row, excluding the skirt */
+            bool  gridInVertices;   /**< Vertices hold their grid position plus the displacement, see OceanTile::getUseVBO() */
+            int   iterations;       /**< Newton iterations inverting the displacement, 0 to look up the undisplaced grid */
+        };
+
+        /** Vertices, normals and motion of an unpacked tile, xyz interleaved. */
+        struct Samples
+        {
+            const float* vertices;
+            const float* normals;       /**< May be NULL if no normals are requested */
+            const float* velocities;    /**< NULL if not requested or not computed */
+            const float* accelerations;
+        };
+
+        /** Results of a query, xyz interleaved. All but heights may be NULL. */
+        struct Outputs
+        {
+            float* heights;
+            float* normals;
+            float* velocities;
+            float* accelerations;
+        };
+
+        /**
+        * Writes the heights and the requested vectors of the points [0,count) interpolated 
+        * from a, blended with b by blend if b.vertices is not NULL. Points off the surface
+        * get a height of 0, an up normal and no motion, as do points of tiles without motion.
+        * Blended normals are not normalised.
+        */
+        typedef void (*SampleFunc)( const Lattice& lattice, const Samples& a, const Samples& b, float blend,
+                                    const float* xs, const float* ys, int count, const Outputs& out );
+
+        /** A lattice cell and the bilinear weights of a position within it. */
+        template<class V>
+        struct Cell
+        {
+            typedef typename V::type vec;
+
+            int idx[V::width];      /**< Index of the xyz of the corner sample (ix,iy) */
+            vec gx, gy;             /**< Position within the tile in samples */
+            vec dx, dy;             /**< Position within the cell */
+        };
+
+        /** Finds the cell of the surface local position (px,py), which may lie off the surface. */
+        template<class V>
+        inline void locate( const Lattice& l, const typename V::type& px, const typename V::type& py, Cell<V>& cell )
+        {
+            typedef typename V::type vec;
+
+            const vec zero        = V::set1(0.f);
+            const vec tileSize    = V::set1(l.tileSize);
+            const vec tileSizeInv = V::set1(l.tileSizeInv);
+            const vec spacingInv  = V::set1(l.spacingInv);
+            const vec lastCell    = V::set1( float(l.resolution-1) );
+
+            const vec tx = V::mul( px, tileSizeInv );
+            const vec ty = V::mul( py, tileSizeInv );
+
+            // Tile of the position, truncation rounded down for positions below 0
+            vec fx = V::toReal( V::truncToInt(tx) );
+            vec fy = V::toReal( V::truncToInt(ty) );
+
+            fx = V::select( V::less(tx,fx), V::sub( fx, V::set1(1.f) ), fx );
+            fy = V::select( V::less(ty,fy), V::sub( fy, V::set1(1.f) ), fy );
+
+            cell.gx = V::mul( V::sub( px, V::mul(fx,tileSize) ), spacingInv );
+            cell.gy = V::mul( V::sub( py, V::mul(fy,tileSize) ), spacingInv );
+
+            // Clamped, so that any input indexes within the tile
+            const vec ix = V::minimum( V::toReal( V::truncToInt( V::maximum(cell.gx,zero) ) ), lastCell );
+            const vec iy = V::minimum( V::toReal( V::truncToInt( V::maximum(cell.gy,zero) ) ), lastCell );
+
+            cell.dx = V::sub( cell.gx, ix );
+            cell.dy = V::sub( cell.gy, iy );
+
+            V::storeInt( cell.idx, V::truncToInt( V::mul( V::add( ix, V::mul( iy, V::set1(float(l.resolution+1)) ) ), V::set1(3.f) ) ) );
+        }
+
+        /** Gathers component c of the four corners of the cell, (ix,iy), (ix+1,iy), (ix,iy+1), (ix+1,iy+1). */
+        template<class V>
+        inline void gatherCorners( const Lattice& l, const float* data, int c, const Cell<V>& cell, typename V::type s[4] )
+        {
+            const int row = 3*(l.resolution+1);
+
+            s[0] = V::gather( data+c,       cell.idx );
+            s[1] = V::gather( data+c+3,     cell.idx );
+            s[2] = V::gather( data+c+row,   cell.idx );
+            s[3] = V::gather( data+c+row+3, cell.idx );
+        }
+
+        /** Corners of the current frame, blended with the next one if blending. */
+        template<class V>
+        inline void sampleCorners( const Lattice& l, const float* a, const float* b, float blend, int c, 
+                                   const Cell<V>& cell, typename V::type s[4] )
+        {
+            gatherCorners<V>( l, a, c, cell, s );
+
+            if (b)
+            {
+                typename V::type t[4];
+                gatherCorners<V>( l, b, c, cell, t );
+
+                const typename V::type wa = V::set1(1.f-blend);
+                const typename V::type wb = V::set1(blend);
+
+                for (int k = 0; k < 4; ++k)
+                    s[k] = V::add( V::mul(s[k],wa), V::mul(t[k],wb) );
+            }
+        }
+
+        template<class V>
+        inline typename V::type bilinear( const typename V::type s[4], const Cell<V>& cell )
+        {
+            const typename V::type one = V::set1(1.f);
+            const typename V::type ex  = V::sub(one,cell.dx);
+            const typename V::type ey  = V::sub(one,cell.dy);
+
+            return V::add( V::add( V::mul( s[0], V::mul(ex,ey) ),      V::mul( s[1], V::mul(cell.dx,ey) ) ),
+                           V::add( V::mul( s[2], V::mul(ex,cell.dy) ), V::mul( s[3], V::mul(cell.dx,cell.dy) ) ) );
+        }
+
+        /**
+        * One Newton step towards p + D(p) = q, in surface local coordinates with y 
+        * pointing down the rows. Where the displaced grid folds over, and the Jacobian
+        * is close to singular, it falls back to the fixed point step p = q - D(p).
+        */
+        template<class V>
+        inline void invertStep( const Lattice& l, const Samples& a, const Samples& b, float blend,
+                                const typename V::type& qx, const typename V::type& qy,
+                                typename V::type& px, typename V::type& py )
+        {
+            typedef typename V::type vec;
+
+            Cell<V> cell;
+            locate<V>( l, px, py, cell );
+
+            vec sx[4], sy[4];
+            sampleCorners<V>( l, a.vertices, b.vertices, blend, 0, cell, sx );
+            sampleCorners<V>( l, a.vertices, b.vertices, blend, 1, cell, sy );
+
+            const vec zero = V::set1(0.f);
+            const vec one  = V::set1(1.f);
+            const vec grid = V::set1( l.gridInVertices ? 1.f : 0.f );
+            const vec sInv = V::set1( l.spacingInv );
+
+            // Vertex y runs against the rows, D = (vx - grid x, -vy - grid y)
+            const vec dispX = V::sub( bilinear<V>(sx,cell), V::mul( grid, V::mul( cell.gx, V::set1(l.spacing) ) ) );
+            const vec dispY = V::sub( zero, V::add( bilinear<V>(sy,cell), V::mul( grid, V::mul( cell.gy, V::set1(l.spacing) ) ) ) );
+
+            const vec ex = V::sub(one,cell.dx);
+            const vec ey = V::sub(one,cell.dy);
+
+            // Partial derivatives of the interpolated vertex over the cell
+            const vec vxx = V::mul( V::add( V::mul( V::sub(sx[1],sx[0]), ey ), V::mul( V::sub(sx[3],sx[2]), cell.dy ) ), sInv );
+            const vec vxy = V::mul( V::add( V::mul( V::sub(sx[2],sx[0]), ex ), V::mul( V::sub(sx[3],sx[1]), cell.dx ) ), sInv );
+            const vec vyx = V::mul( V::add( V::mul( V::sub(sy[1],sy[0]), ey ), V::mul( V::sub(sy[3],sy[2]), cell.dy ) ), sInv );
+            const vec vyy = V::mul( V::add( V::mul( V::sub(sy[2],sy[0]), ex ), V::mul( V::sub(sy[3],sy[1]), cell.dx ) ), sInv );
+
+            // J = I + dD/dp
+            const vec base = V::sub( one, grid );
+            const vec j00 = V::add( base, vxx );
+            const vec j01 = vxy;
+            const vec j10 = V::sub( zero, vyx );
+            const vec j11 = V::sub( base, vyy );
+
+            const vec rx = V::sub( V::add(px,dispX), qx );
+            const vec ry = V::sub( V::add(py,dispY), qy );
+
+            const vec det = V::sub( V::mul(j00,j11), V::mul(j01,j10) );
+            const typename V::mask invertible = V::less( V::set1(0.05f), det );
+            const vec detInv = V::div( one, V::select( invertible, det, one ) );
+
+            const vec nx = V::mul( V::sub( V::mul(j11,rx), V::mul(j01,ry) ), detInv );
+            const vec ny = V::mul( V::sub( V::mul(j00,ry), V::mul(j10,rx) ), detInv );
+
+            px = V::sub( px, V::select( invertible, nx, rx ) );
+            py = V::sub( py, V::select( invertible, ny, ry ) );
+        }
+
+        /** Interpolates the xyz vectors a, blended with b, at the points i of the cell into out. */
+        template<class V>
+        inline void sampleVectors( const Lattice& l, const float* a, const float* b, float blend, const Cell<V>& cell, 
+                                   const typename V::mask& inside, float outsideZ, int i, float* out )
+        {
+            typedef typename V::type vec;
+
+            const vec zero = V::set1(0.f);
+
+            float v[3][V::width];
+
+            for (int c = 0; c < 3; ++c)
+            {
+                if (a)
+                {
+                    vec s[4];
+                    sampleCorners<V>( l, a, b, blend, c, cell, s );
+                    V::store( v[c], V::select( inside, bilinear<V>(s,cell), c == 2 ? V::set1(outsideZ) : zero ) );
+                }
+                else
+                {
+                    V::store( v[c], zero );
+                }
+            }
+
+            for (int k = 0; k < V::width; ++k)
+            {
+                float* p = out + (i+k)*3;
+                p[0] = v[0][k];
+                p[1] = v[1][k];
+                p[2] = v[2][k];
+            }
+        }
+
+        template<class V>
+        inline void sampleStep( const Lattice& l, const Samples& a, const Samples& b, float blend,
+                                const float* xs, const float* ys, int i, const Outputs& out )
+        {
+            typedef typename V::type vec;
+            typedef typename V::mask mask;
+
+            const vec zero   = V::set1(0.f);
+            const vec extent = V::set1(l.extent);
+
+            const vec ox = V::sub( V::load(xs+i), V::set1(l.originX) );
+            const vec oy = V::sub( V::set1(l.originY), V::load(ys+i) );
+
+            const mask inside = V::maskAnd( V::maskAnd( V::lessEqual(zero,ox), V::less(ox,extent) ),
+                                            V::maskAnd( V::lessEqual(zero,oy), V::less(oy,extent) ) );
+
+            // Clamp first so that points off the surface, or NaN, still index within the tile
+            const vec qx = V::minimum( V::maximum(ox,zero), extent );
+            const vec qy = V::minimum( V::maximum(oy,zero), extent );
+
+            vec px = qx;
+            vec py = qy;
+
+            for (int it = 0; it < l.iterations; ++it)
+                invertStep<V>( l, a, b, blend, qx, qy, px, py );
+
+            Cell<V> cell;
+            locate<V>( l, px, py, cell );
+
+            vec s[4];
+            sampleCorners<V>( l, a.vertices, b.vertices, blend, 2, cell, s );
+
+            V::store( out.heights+i, V::select( inside, bilinear<V>(s,cell), zero ) );
+
+            if (out.normals)
+                sampleVectors<V>( l, a.normals, b.normals, blend, cell, inside, 1.f, i, out.normals );
+
+            // The water at the query position is the water displaced from p, so it moves as p does
+            if (out.velocities)
+                sampleVectors<V>( l, a.velocities, b.velocities, blend, cell, inside, 0.f, i, out.velocities );
+
+            if (out.accelerations)
+                sampleVectors<V>( l, a.accelerations, b.accelerations, blend, cell, inside, 0.f, i, out.accelerations );
+        }
+
+        template<class V>
+        void sample( const Lattice& lattice, const Samples& a, const Samples& b, float blend,
+                     const float* xs, const float* ys, int count, const Outputs& out )
+        {
+            int i = 0;
+
+            for (; i+V::width <= count; i += V::width)
+                sampleStep<V>( lattice, a, b, blend, xs, ys, i, out );
+
+            for (; i < count; ++i)
+                sampleStep< SIMD::ScalarVec<float> >( lattice, a, b, blend, xs, ys, i, out );
+        }
+
+        /** AVX2 instantiation, defined in FFTOceanTechniqueAVX2.cpp. */
+        void sampleAVX2( const Lattice& lattice, const Samples& a, const Samples& b, float blend,
+                         const float* xs, const float* ys, int count, const Outputs& out );
+    }
+}
@@ -82,7 +82,7 @@ void WaterTrochoids::createWaves(void)
     for (int i = 0; i < NUM_WAVES; i++) 
     {
         // Randomly rotate the wave around a main direction
-        float rads = _angleDev * nextRandomDouble(-1,1);
+        float rads = _angleDev * nextRandomDouble(-1,1,2*i);
         float rx = cos(rads);
         float ry = sin(rads);
 
@@ -100,7 +100,7 @@ void WaterTrochoids::createWaves(void)
         _waves[i].w = sqrt(9.8f*k);
 
         // Initialize the wave initial phase
-        _waves[i].phi0 = nextRandomDouble(0, osg::PI*2.f);
+        _waves[i].phi0 = nextRandomDouble(0, osg::PI*2.f, 2*i+1);
 
         // Move to next wave
         lambda *= _lambdaMul;